@@ -0,0 +1,626 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <linux/limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "compiler_args.h"
+#include "record.h"
+#include "ring.h"
+
+#pragma once
+
+// Wrapper side of ec: this code runs in place of every compiler of the build,
+// records the invocation through one of the transports below and execs the
+// real compiler. It sticks to libc and raw syscalls, no iostreams, no
+// std::filesystem and no heap for ordinary command lines, so that ec-shim can
+// be a small static binary that starts in a fraction of the time ec needs.
+
+static constexpr const char *execLogPrefix = "exec.log.";
+
+// The sequence counter lives in a small file inside CC_LOGDIR that invocateBuild
+// creates before the build starts; every wrapper maps it and bumps it atomically,
+// so picking the next log number is O(1) and needs no lock.
+static constexpr const char *execSeqFilename = "ec.seq";
+
+// In append mode all wrappers share one log in CC_LOGDIR and add one
+// record (see record.h) per invocation with a single O_APPEND write().
+static constexpr const char *execAppendLogFilename = "exec.log";
+
+// In socket mode the invocateBuild parent listens on a SOCK_SEQPACKET socket in
+// CC_LOGDIR and every wrapper sends its record as one datagram. Records that
+// cannot be sent are spilled to the append log.
+static constexpr const char *execSocketFilename = "ec.sock";
+
+// Snapshots of @file arguments live in this directory of CC_LOGDIR, one per
+// identity (device, inode, size, mtime) of the file, see snapshotResponseFile.
+static constexpr const char *responseFileDirName = "rsp";
+
+// In ring mode records go into a shared memory ring (see ring.h) that the
+// wrappers find through CC_RING as "<fd>:<size>"; full rings spill to the
+// append log.
+
+[[noreturn]] inline void captureFail(const char *what, const char *path) {
+	dprintf(STDERR_FILENO, "%s: %s: %s\n", what, path, strerror(errno));
+	exit(-1);
+}
+
+inline uint64_t *mapSequenceCounter(const char *seqFile, bool create) {
+	int flags = create ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDWR;
+	int fd = open(seqFile, flags | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		return nullptr;
+	}
+
+	if (create && ftruncate(fd, sizeof(uint64_t)) < 0) {
+		close(fd);
+		return nullptr;
+	}
+
+	void *counter = mmap(nullptr, sizeof(uint64_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+
+	return counter == MAP_FAILED ? nullptr : static_cast<uint64_t*>(counter);
+}
+
+inline void writeNumberedRecord(const char *record, size_t length) {
+	const char *logDir = getenv("CC_LOGDIR");
+	if (logDir == nullptr) {
+		dprintf(STDERR_FILENO, "CC_LOGDIR not set\n");
+		exit(-1);
+	}
+
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), "%s/%s", logDir, execSeqFilename);
+	uint64_t *counter = mapSequenceCounter(path, false);
+	if (counter == nullptr) {
+		captureFail("could not map", path);
+	}
+	uint64_t processNumber = __atomic_add_fetch(counter, 1, __ATOMIC_RELAXED);
+	munmap(counter, sizeof(uint64_t));
+
+	snprintf(path, sizeof(path), "%s/%s%llu", logDir, execLogPrefix, static_cast<unsigned long long>(processNumber));
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		captureFail("could not open", path);
+	}
+	if (write(fd, record, length) != static_cast<ssize_t>(length)) {
+		captureFail("writing failed", path);
+	}
+	close(fd);
+}
+
+inline void appendRecord(const char *record, size_t length) {
+	const char *logFile = getenv("CC_LOGFILE");
+	int fd = open(logFile, O_WRONLY | O_APPEND | O_CLOEXEC);
+	if (fd < 0) {
+		captureFail("could not open", logFile);
+	}
+
+	// one write per record: O_APPEND keeps concurrent records from interleaving
+	if (write(fd, record, length) != static_cast<ssize_t>(length)) {
+		captureFail("appending failed", logFile);
+	}
+
+	close(fd);
+}
+
+inline bool sendRecord(const char *record, size_t length) {
+	const char *socketPath = getenv("CC_SOCKET");
+
+	sockaddr_un addr{};
+	addr.sun_family = AF_UNIX;
+	if (strlen(socketPath) >= sizeof(addr.sun_path)) {
+		return false;
+	}
+	strcpy(addr.sun_path, socketPath);
+
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		return false;
+	}
+
+	bool sent = connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == 0 &&
+		send(fd, record, length, MSG_NOSIGNAL) == static_cast<ssize_t>(length);
+	close(fd);
+
+	return sent;
+}
+
+inline bool pushRecord(const char *record, size_t length) {
+	int fd;
+	size_t size;
+	if (sscanf(getenv("CC_RING"), "%d:%zu", &fd, &size) != 2) {
+		return false;
+	}
+
+	RecordRing ring{fd, size};
+
+	return ring.valid() && ring.push(record, length);
+}
+
+inline void submitRecord(const char *record, size_t length) {
+	if (getenv("CC_RING") != nullptr && pushRecord(record, length)) {
+		return;
+	}
+
+	if (getenv("CC_SOCKET") != nullptr && sendRecord(record, length)) {
+		return;
+	}
+
+	if (getenv("CC_LOGFILE") != nullptr) {
+		appendRecord(record, length);
+	} else {
+		writeNumberedRecord(record, length);
+	}
+}
+
+// Positions of the sources in argv (see compiler_args.h), written into the
+// caller's buffer when they fit, else into one from malloc() that the caller
+// frees; nullptr if that fails.
+inline uint32_t *findSources(char *const *argv, size_t argc, uint32_t *buffer, size_t bufferSize, size_t &count) {
+	count = compiler_args::countSources(argv, argc);
+	uint32_t *sources = count <= bufferSize ? buffer : static_cast<uint32_t*>(malloc(count * sizeof(uint32_t)));
+	if (sources == nullptr) {
+		return nullptr;
+	}
+
+	size_t next = 0;
+	compiler_args::forEachSource(argv, argc, [sources, &next](size_t i) { sources[next++] = static_cast<uint32_t>(i); });
+
+	return sources;
+}
+
+// Copies the response file path (relative to dirFd) into
+// CC_LOGDIR/rsp/ and puts the copy's name into snapshot (PATH_MAX bytes).
+// Thousands of compiles of a target share the same file, only the first one
+// copies it, the others find the snapshot by its identity with one stat and
+// one access. false if path cannot be read; the argument stays as it is then.
+inline bool snapshotResponseFile(int dirFd, const char *path, const char *logDir, char *snapshot) {
+	int fd = openat(dirFd, path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return false;
+	}
+	snprintf(snapshot, PATH_MAX, "%s/%s/%llx-%llx-%llx-%llx.%09ld", logDir, responseFileDirName,
+		static_cast<unsigned long long>(st.st_dev), static_cast<unsigned long long>(st.st_ino),
+		static_cast<unsigned long long>(st.st_size), static_cast<unsigned long long>(st.st_mtim.tv_sec),
+		st.st_mtim.tv_nsec);
+	if (access(snapshot, F_OK) == 0) {
+		close(fd);
+		return true;
+	}
+
+	char *content = static_cast<char*>(malloc(st.st_size + 1));
+	ssize_t length = content == nullptr ? -1 : read(fd, content, st.st_size);
+	close(fd);
+	if (length != st.st_size) {
+		free(content);
+		return false;
+	}
+
+	// another wrapper may be copying the same file right now, the rename
+	// makes one of the complete copies win
+	char tmpPath[PATH_MAX];
+	snprintf(tmpPath, sizeof(tmpPath), "%s.%d", snapshot, static_cast<int>(getpid()));
+	int out = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	bool written = out >= 0 && write(out, content, length) == length;
+	if (out >= 0) {
+		close(out);
+	}
+	free(content);
+	if (!written || rename(tmpPath, snapshot) < 0) {
+		unlink(tmpPath);
+		return false;
+	}
+
+	return true;
+}
+
+inline bool isResponseFileArgument(const char *argument) {
+	return argument[0] == '@' && argument[1] != '\0';
+}
+
+inline size_t countResponseFileArguments(char *const *argv, size_t argc) {
+	size_t count = 0;
+	for (size_t i = 1; i < argc; i++) {
+		count += isResponseFileArgument(argv[i]);
+	}
+	return count;
+}
+
+// Snapshots of the @file arguments of argv; snapshots and paths (PATH_MAX
+// bytes each) have room for all of them, see countResponseFileArguments()
+inline size_t snapshotResponseFiles(char *const *argv, size_t argc, int dirFd, const char *logDir,
+                                    ResponseFileSnapshot *snapshots, char (*paths)[PATH_MAX]) {
+	size_t count = 0;
+	for (size_t i = 1; logDir != nullptr && i < argc; i++) {
+		if (isResponseFileArgument(argv[i]) && snapshotResponseFile(dirFd, argv[i] + 1, logDir, paths[count])) {
+			snapshots[count] = {static_cast<uint32_t>(i), paths[count]};
+			count++;
+		}
+	}
+	return count;
+}
+
+// Records the invocation if it compiles a translation unit, or any invocation
+// when ec runs with --all-invocations (CC_ALL_INVOCATIONS). Returns whether it
+// did.
+inline bool logExec(const char *exe, char *const *argv) {
+	char currentDir[PATH_MAX];
+	if (getcwd(currentDir, sizeof(currentDir)) == nullptr) {
+		captureFail("getcwd failed", ".");
+	}
+
+	size_t argc = 0;
+	while (argv[argc] != nullptr) {
+		argc++;
+	}
+	compiler_args::Invocation invocation = compiler_args::classify(argv, argc, currentDir);
+	if (getenv("CC_ALL_INVOCATIONS") == nullptr && invocation != compiler_args::Invocation::Compile &&
+	    invocation != compiler_args::Invocation::ResponseFile) {
+		return false;
+	}
+
+	// a few @files fit on the stack, more need the heap
+	ResponseFileSnapshot snapshotBuffer[4];
+	char snapshotPathBuffer[4][PATH_MAX];
+	ResponseFileSnapshot *snapshots = snapshotBuffer;
+	char (*snapshotPaths)[PATH_MAX] = snapshotPathBuffer;
+	size_t responseFileCount = countResponseFileArguments(argv, argc);
+	if (responseFileCount > sizeof(snapshotBuffer) / sizeof(snapshotBuffer[0])) {
+		snapshots = static_cast<ResponseFileSnapshot*>(malloc(responseFileCount * sizeof(ResponseFileSnapshot)));
+		snapshotPaths = static_cast<char(*)[PATH_MAX]>(malloc(responseFileCount * PATH_MAX));
+		if (snapshots == nullptr || snapshotPaths == nullptr) {
+			captureFail("allocating response files failed", exe);
+		}
+	}
+	size_t snapshotCount = snapshotResponseFiles(argv, argc, AT_FDCWD, getenv("CC_LOGDIR"), snapshots, snapshotPaths);
+	// nothing to expand, ec would only see a command line without sources
+	if (invocation == compiler_args::Invocation::ResponseFile && snapshotCount == 0 &&
+	    getenv("CC_ALL_INVOCATIONS") == nullptr) {
+		if (snapshots != snapshotBuffer) {
+			free(snapshots);
+			free(snapshotPaths);
+		}
+		return false;
+	}
+
+	timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	uint32_t sourceBuffer[256];
+	size_t sourceCount;
+	uint32_t *sources = findSources(argv, argc, sourceBuffer, sizeof(sourceBuffer) / sizeof(sourceBuffer[0]), sourceCount);
+	if (sources == nullptr) {
+		captureFail("allocating sources failed", exe);
+	}
+
+	RecordFields fields;
+	fields.pid = getpid();
+	fields.ppid = getppid();
+	fields.timestamp = static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+	fields.cwd = currentDir;
+	fields.exe = exe;
+	fields.argv = argv;
+	fields.sources = sources;
+	fields.sourceCount = sourceCount;
+	fields.responseFiles = snapshots;
+	fields.responseFileCount = snapshotCount;
+
+	// only unusually long command lines need the heap
+	char stackBuffer[16384];
+	size_t length = encodedRecordSize(fields);
+	char *record = length <= sizeof(stackBuffer) ? stackBuffer : static_cast<char*>(malloc(length));
+	if (record == nullptr) {
+		captureFail("allocating record failed", exe);
+	}
+
+	encodeRecord(fields, record);
+	submitRecord(record, length);
+
+	if (record != stackBuffer) {
+		free(record);
+	}
+	if (sources != sourceBuffer) {
+		free(sources);
+	}
+	if (snapshots != snapshotBuffer) {
+		free(snapshots);
+		free(snapshotPaths);
+	}
+
+	return true;
+}
+
+// Creates path empty, or empties it; as far as make and ninja can tell the
+// compiler just wrote it
+inline bool touchOutput(const char *path, mode_t mode) {
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+	if (fd < 0) {
+		return false;
+	}
+	close(fd);
+	return true;
+}
+
+// path with its extension replaced, in the current directory if inCurrentDir
+// like GCC derives a.o from src/a.c; false if it does not fit PATH_MAX
+inline bool replaceExtension(const char *path, const char *extension, bool inCurrentDir, char *out) {
+	const char *slash = strrchr(path, '/');
+	const char *name = inCurrentDir && slash != nullptr ? slash + 1 : path;
+	const char *base = slash != nullptr ? slash + 1 : path;
+	const char *dot = strrchr(base, '.');
+	int length = dot != nullptr ? dot - name : strlen(name);
+	return snprintf(out, PATH_MAX, "%.*s%s", length, name, extension) < PATH_MAX;
+}
+
+// The depfile -MD would write, without the headers: the -MT and -MQ targets,
+// or output, depend on the sources, or only on argv[source] if source > 0.
+// Enough for ninja's deps=gcc and for make's -include.
+inline bool writeDepFile(char *const *argv, size_t argc, const char *path, const char *output, size_t source) {
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+	if (fd < 0) {
+		return false;
+	}
+
+	bool named = false;
+	for (size_t i = 1; i < argc; i++) {
+		const char *target = nullptr;
+		if ((strcmp(argv[i], "-MT") == 0 || strcmp(argv[i], "-MQ") == 0) && i + 1 < argc) {
+			target = argv[++i];
+		} else if ((strncmp(argv[i], "-MT", 3) == 0 || strncmp(argv[i], "-MQ", 3) == 0) && argv[i][3] != '\0') {
+			target = argv[i] + 3;
+		} else if (compiler_args::takesSeparateValue(argv[i])) {
+			i++;
+		}
+		if (target != nullptr) {
+			dprintf(fd, named ? " %s" : "%s", target);
+			named = true;
+		}
+	}
+	if (!named) {
+		dprintf(fd, "%s", output);
+	}
+	dprintf(fd, ":");
+	compiler_args::forEachSource(argv, argc, [fd, argv, source](size_t i) {
+		if (source == 0 || i == source) {
+			dprintf(fd, " %s", argv[i]);
+		}
+	});
+	dprintf(fd, "\n");
+
+	close(fd);
+	return true;
+}
+
+// ec --no-compile (CC_NO_COMPILE): instead of running the compiler, creates
+// what it would have written, empty: the -o file, else one object per source
+// with -c or -S, else a.out, plus the depfile of -MD and -MMD. Returns false
+// if the compiler has to run after all: configure probes, whose output gets
+// run or inspected, -E, -M and queries, whose output gets read, and @file
+// command lines that hide their -o.
+inline bool fakeCompile(char *const *argv) {
+	char currentDir[PATH_MAX];
+	if (getcwd(currentDir, sizeof(currentDir)) == nullptr) {
+		return false;
+	}
+
+	size_t argc = 0;
+	while (argv[argc] != nullptr) {
+		argc++;
+	}
+	compiler_args::Invocation invocation = compiler_args::classify(argv, argc, currentDir);
+	if (invocation != compiler_args::Invocation::Compile && invocation != compiler_args::Invocation::NoSources &&
+	    invocation != compiler_args::Invocation::ResponseFile) {
+		return false;
+	}
+
+	const char *output = nullptr;
+	const char *depFile = nullptr;
+	bool compileOnly = false;
+	bool assemblyOnly = false;
+	bool syntaxOnly = false;
+	bool dependencies = false;
+	for (size_t i = 1; i < argc; i++) {
+		const char *argument = argv[i];
+		if (strcmp(argument, "-o") == 0 && i + 1 < argc) {
+			output = argv[++i];
+		} else if (strncmp(argument, "-o", 2) == 0 && argument[2] != '\0' && strncmp(argument, "-obj", 4) != 0) {
+			output = argument + 2;
+		} else if (strcmp(argument, "-MF") == 0 && i + 1 < argc) {
+			depFile = argv[++i];
+		} else if (strncmp(argument, "-MF", 3) == 0 && argument[3] != '\0') {
+			depFile = argument + 3;
+		} else if (strcmp(argument, "-c") == 0) {
+			compileOnly = true;
+		} else if (strcmp(argument, "-S") == 0) {
+			assemblyOnly = true;
+		} else if (strcmp(argument, "-fsyntax-only") == 0) {
+			syntaxOnly = true;
+		} else if (strcmp(argument, "-MD") == 0 || strcmp(argument, "-MMD") == 0) {
+			dependencies = true;
+		} else if (compiler_args::takesSeparateValue(argument)) {
+			i++;
+		}
+	}
+	if (invocation == compiler_args::Invocation::ResponseFile && output == nullptr) {
+		return false;
+	}
+	if (syntaxOnly) {
+		return true;
+	}
+
+	char derived[PATH_MAX];
+	bool link = !compileOnly && !assemblyOnly;
+	if (output != nullptr || link) {
+		output = output != nullptr ? output : "a.out";
+		if (!touchOutput(output, link ? 0777 : 0666)) {
+			return false;
+		}
+		if (!dependencies) {
+			return true;
+		}
+		// -MD names the depfile after -o, a.o gets a.d
+		if (depFile == nullptr && !replaceExtension(output, ".d", false, derived)) {
+			return false;
+		}
+		return writeDepFile(argv, argc, depFile != nullptr ? depFile : derived, output, 0);
+	}
+
+	// a.o and a.d for each a.c, in the current directory
+	bool written = true;
+	compiler_args::forEachSource(argv, argc, [&](size_t i) {
+		char object[PATH_MAX];
+		written = written && replaceExtension(argv[i], assemblyOnly ? ".s" : ".o", true, object) &&
+			touchOutput(object, 0666);
+		if (written && dependencies) {
+			written = (depFile != nullptr || replaceExtension(argv[i], ".d", true, derived)) &&
+				writeDepFile(argv, argc, depFile != nullptr ? depFile : derived, object, i);
+		}
+	});
+	return written;
+}
+
+// First executable called exe along PATH, with symlinks resolved. Only needed
+// when the wrapper runs without a table from invocateBuild.
+inline bool resolveCompiler(const char *exe, char *resolved) {
+	const char *path = getenv("PATH");
+	if (path == nullptr) {
+		return false;
+	}
+
+	char candidate[PATH_MAX];
+	while (*path != '\0') {
+		const char *end = strchrnul(path, ':');
+		int length = end - path;
+		snprintf(candidate, sizeof(candidate), "%.*s/%s", length, path, exe);
+		if (length > 0 && access(candidate, X_OK) == 0 && realpath(candidate, resolved) != nullptr) {
+			return true;
+		}
+		path = *end == ':' ? end + 1 : end;
+	}
+
+	return false;
+}
+
+// invocateBuild resolves every compiler before the build and passes the result
+// as CC_COMPILERS, one "name<TAB>binName<TAB>/real/path" line per name, so
+// the common case is a scan over a short string without a single syscall.
+// binName is what the real compiler is mounted as in CC_BINDIR.
+inline bool lookupCompiler(const char *name, char *binName, char *resolved) {
+	const char *table = getenv("CC_COMPILERS");
+	if (table == nullptr) {
+		return false;
+	}
+
+	size_t nameLength = strlen(name);
+	while (*table != '\0') {
+		const char *end = strchrnul(table, '\n');
+		if (strncmp(table, name, nameLength) == 0 && table[nameLength] == '\t') {
+			const char *bin = table + nameLength + 1;
+			const char *path = static_cast<const char*>(memchr(bin, '\t', end - bin));
+			if (path == nullptr || path - bin >= NAME_MAX || end - path > PATH_MAX) {
+				return false;
+			}
+			memcpy(binName, bin, path - bin);
+			binName[path - bin] = '\0';
+			path++;
+			memcpy(resolved, path, end - path);
+			resolved[end - path] = '\0';
+			return true;
+		}
+		table = *end == '\n' ? end + 1 : end;
+	}
+
+	return false;
+}
+
+// For names the table does not know, e.g. a symlink outside PATH: the binary
+// we were exec'd as is still one of the mounted ones.
+inline bool lookupCompilerBinary(const char *path, char *binName) {
+	const char *table = getenv("CC_COMPILERS");
+	if (table == nullptr) {
+		return false;
+	}
+
+	size_t pathLength = strlen(path);
+	while (*table != '\0') {
+		const char *end = strchrnul(table, '\n');
+		const char *bin = static_cast<const char*>(memchr(table, '\t', end - table));
+		const char *origPath = bin == nullptr ? nullptr : static_cast<const char*>(memchr(bin + 1, '\t', end - bin - 1));
+		if (origPath != nullptr && static_cast<size_t>(end - origPath - 1) == pathLength &&
+		    memcmp(origPath + 1, path, pathLength) == 0 && origPath - bin - 1 <= NAME_MAX) {
+			memcpy(binName, bin + 1, origPath - bin - 1);
+			binName[origPath - bin - 1] = '\0';
+			return true;
+		}
+		table = *end == '\n' ? end + 1 : end;
+	}
+
+	return false;
+}
+
+inline bool isTabledCompiler(const char *name) {
+	char binName[NAME_MAX + 1];
+	char resolved[PATH_MAX];
+	return lookupCompiler(name, binName, resolved);
+}
+
+inline int execCompiler(int argc, char **argv) {
+	const char *ccBinDir = getenv("CC_BINDIR");
+	if (ccBinDir == nullptr) {
+		dprintf(STDERR_FILENO, "CC_BINDIR not set\n");
+		exit(-1);
+	}
+
+	const char *slash = strrchr(argv[0], '/');
+	const char *name = slash == nullptr ? argv[0] : slash + 1;
+
+	char binName[NAME_MAX + 1];
+	char originalPath[PATH_MAX];
+	bool resolved = lookupCompiler(name, binName, originalPath);
+	if (!resolved) {
+		ssize_t length = readlink("/proc/self/exe", originalPath, sizeof(originalPath) - 1);
+		if (length > 0) {
+			originalPath[length] = '\0';
+			resolved = lookupCompilerBinary(originalPath, binName);
+		}
+	}
+	if (!resolved) {
+		strncpy(binName, name, NAME_MAX);
+		binName[NAME_MAX] = '\0';
+		resolved = resolveCompiler(name, originalPath);
+	}
+	// A compiler run by a recorded one (ccache as gcc running the real gcc, a cc
+	// script running gcc) is part of the same compile; the outer command line
+	// is what the build asked for.
+	if (getenv("CC_RECORDED") == nullptr && logExec(resolved ? originalPath : name, argv)) {
+		setenv("CC_RECORDED", "1", 1);
+	}
+	if (getenv("CC_NO_COMPILE") != nullptr && fakeCompile(argv)) {
+		return 0;
+	}
+
+	char pathToExec[PATH_MAX];
+	snprintf(pathToExec, sizeof(pathToExec), "%s/%s", ccBinDir, binName);
+
+	// gcc has a weird bug if argv[0] == "./gcc"
+	argv[0] = const_cast<char*>(name);
+	execv(pathToExec, argv);
+
+	return -1;
+}
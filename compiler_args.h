@@ -0,0 +1,271 @@
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "compiler_names.h"
+
+#pragma once
+
+// Which arguments of a GCC or Clang command line are the sources it compiles,
+// decided from the arguments alone: the wrappers run once per compile and
+// should not pay a syscall per argument. Like compiler_names.h this sticks to
+// constexpr tables and string_view, ec-shim and ec-preload.so use it too.
+namespace compiler_args {
+
+// Options whose value is the next argument. The joined spellings (-ofoo.o,
+// -I/usr/include) start with '-' anyway.
+static constexpr std::string_view separateValueOptions[] = {
+	"--include", "--param", "--sysroot", "-A", "-B", "-D", "-F", "-G", "-I", "-L", "-MF", "-MJ", "-MQ", "-MT", "-T",
+	"-U", "-Xanalyzer", "-Xarch_device", "-Xarch_host", "-Xassembler", "-Xclang", "-Xcuda-fatbinary",
+	"-Xcuda-ptxas", "-Xlinker", "-Xopenmp-target", "-Xpreprocessor", "-arch", "-aux-info", "-b", "-dependency-file",
+	"-dumpbase", "-dumpbase-ext", "-dumpdir", "-e", "-idirafter", "-imacros", "-imultilib", "-include", "-iprefix",
+	"-iquote", "-isysroot", "-isystem", "-isystem-after", "-ivfsoverlay", "-iwithprefix", "-iwithprefixbefore",
+	"-iwithsysroot", "-l", "-mllvm", "-o", "-target", "-u", "-x", "-z",
+};
+
+// Extensions GCC or Clang compile as a translation unit, per language.
+static constexpr std::string_view sourceExtensions[] = {
+	// C, C++ and their preprocessed forms
+	"c", "i", "cc", "cp", "cxx", "cpp", "CPP", "c++", "C", "ii", "cppm", "ixx", "ccm", "cxxm", "c++m",
+	// headers compiled on their own, e.g. into precompiled headers
+	"h", "hh", "H", "hp", "hxx", "hpp", "HPP", "h++", "tcc",
+	// Objective-C and Objective-C++
+	"m", "mi", "mm", "M", "mii",
+	// assembler, CUDA, HIP and OpenCL
+	"s", "S", "sx", "cu", "hip", "cl", "clcpp",
+};
+
+static constexpr size_t separateValueOptionCount = sizeof(separateValueOptions) / sizeof(separateValueOptions[0]);
+
+// Perfect hash over separateValueOptions, built like the one over
+// compilerNames, but with at least four slots per option so that a seed is
+// found quickly. An argument costs one hash and at most one compare.
+constexpr size_t optionTableSize() {
+	size_t size = 1;
+	while (size < 4 * separateValueOptionCount) {
+		size *= 2;
+	}
+	return size;
+}
+
+constexpr uint32_t findOptionSeed() {
+	for (uint32_t seed = 0;; seed++) {
+		bool used[optionTableSize()] = {};
+		bool collision = false;
+		for (std::string_view option : separateValueOptions) {
+			size_t slot = compiler_name_hash::hash(option, seed) & (optionTableSize() - 1);
+			collision = collision || used[slot];
+			used[slot] = true;
+		}
+		if (!collision) {
+			return seed;
+		}
+	}
+}
+
+static constexpr uint32_t optionSeed = findOptionSeed();
+
+struct OptionTable {
+	int8_t slots[optionTableSize()];
+};
+
+constexpr OptionTable buildOptionTable() {
+	OptionTable table{};
+	for (size_t i = 0; i < optionTableSize(); i++) {
+		table.slots[i] = -1;
+	}
+	for (size_t i = 0; i < separateValueOptionCount; i++) {
+		table.slots[compiler_name_hash::hash(separateValueOptions[i], optionSeed) & (optionTableSize() - 1)] = static_cast<int8_t>(i);
+	}
+	return table;
+}
+
+static constexpr OptionTable optionTable = buildOptionTable();
+
+constexpr size_t maxOptionLength() {
+	size_t length = 0;
+	for (std::string_view option : separateValueOptions) {
+		length = option.size() > length ? option.size() : length;
+	}
+	return length;
+}
+
+static_assert(separateValueOptionCount < 128, "slots are int8_t");
+
+constexpr bool takesSeparateValue(std::string_view option) {
+	// long arguments like -I/usr/include/... are never one of them
+	if (option.size() > maxOptionLength()) {
+		return false;
+	}
+	int8_t index = optionTable.slots[compiler_name_hash::hash(option, optionSeed) & (optionTableSize() - 1)];
+	return index >= 0 && separateValueOptions[index] == option;
+}
+
+constexpr bool hasSourceExtension(std::string_view path) {
+	size_t dot = path.rfind('.');
+	size_t slash = path.rfind('/');
+	if (dot == std::string_view::npos || (slash != std::string_view::npos && slash > dot)) {
+		return false;
+	}
+	std::string_view extension{path.data() + dot + 1, path.size() - dot - 1};
+	for (std::string_view sourceExtension : sourceExtensions) {
+		if (extension == sourceExtension) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Calls source(i) for every argv[i], 0 < i < argc, that the compiler takes as
+// a source: positional arguments with a source extension, or any positional
+// argument while -x names a language. argv[i] has to convert to
+// std::string_view.
+template<typename Argv, typename Source>
+constexpr void forEachSource(const Argv &argv, size_t argc, Source source) {
+	bool languageForced = false;
+	for (size_t i = 1; i < argc; i++) {
+		std::string_view argument{argv[i]};
+		if (argument.size() > 1 && argument[0] == '-') {
+			std::string_view language;
+			if (argument == "-x" && i + 1 < argc) {
+				language = argv[i + 1];
+			} else if (argument.size() > 2 && argument[1] == 'x') {
+				language = {argument.data() + 2, argument.size() - 2};
+			}
+			if (!language.empty()) {
+				languageForced = language != "none";
+			}
+			if (takesSeparateValue(argument)) {
+				i++;
+			}
+			continue;
+		}
+		// "-" is stdin
+		if (argument == "-" || argument.empty()) {
+			continue;
+		}
+		if (languageForced || hasSourceExtension(argument)) {
+			source(i);
+		}
+	}
+}
+
+template<typename Argv>
+constexpr size_t countSources(const Argv &argv, size_t argc) {
+	size_t count = 0;
+	forEachSource(argv, argc, [&count](size_t) { count++; });
+	return count;
+}
+
+// What a compiler invocation does, as far as the database is concerned. Only
+// Compile makes an entry; the rest used to end up with the directory as file.
+enum class Invocation {
+	// compiles at least one source, to an object, to assembly or just checks it
+	Compile,
+	// links, or has no source for another reason
+	NoSources,
+	// -E, -M or -MM: preprocesses only
+	Preprocess,
+	// --version, -dumpmachine, -print-*, -###: asks the compiler something
+	Query,
+	// clang -cc1 and friends: the driver running its own frontend
+	Frontend,
+	// configure checks: CMake try_compile and compiler id, autoconf conftest,
+	// meson sanity checks
+	Probe,
+	// no source in sight, but @file arguments that may hold some; decided
+	// again once they are expanded
+	ResponseFile,
+};
+
+constexpr bool startsWith(std::string_view s, std::string_view prefix) {
+	return s.size() >= prefix.size() && std::string_view{s.data(), prefix.size()} == prefix;
+}
+
+constexpr bool isQueryOption(std::string_view argument) {
+	return argument == "--version" || argument == "-dumpversion" || argument == "-dumpfullversion" ||
+		argument == "-dumpmachine" || argument == "-dumpspecs" || argument == "-###" || argument == "--help" ||
+		startsWith(argument, "--help=") || startsWith(argument, "-print-") || startsWith(argument, "--print-");
+}
+
+// autoconf's test program, conftest.c, conftest.o, conftest
+constexpr bool isConftest(std::string_view path) {
+	size_t slash = path.rfind('/');
+	// no substr(), see isCompilerName()
+	std::string_view name = slash == std::string_view::npos ? path :
+		std::string_view{path.data() + slash + 1, path.size() - slash - 1};
+	return name == "conftest" || startsWith(name, "conftest.");
+}
+
+// cwd is the directory the compiler runs in; nothing here touches the disk
+template<typename Argv>
+constexpr Invocation classify(const Argv &argv, size_t argc, std::string_view cwd) {
+	if (argc > 1) {
+		std::string_view first{argv[1]};
+		if (first == "-cc1" || first == "-cc1as" || first == "-cc1gen-reproducer") {
+			return Invocation::Frontend;
+		}
+	}
+
+	bool preprocess = false;
+	bool responseFile = false;
+	bool conftest = false;
+	for (size_t i = 1; i < argc; i++) {
+		std::string_view argument{argv[i]};
+		if (isQueryOption(argument)) {
+			return Invocation::Query;
+		}
+		preprocess = preprocess || argument == "-E" || argument == "-M" || argument == "-MM";
+		responseFile = responseFile || (argument.size() > 1 && argument[0] == '@');
+		if (argument == "-o" && i + 1 < argc) {
+			conftest = conftest || isConftest(argv[i + 1]);
+		}
+	}
+	if (preprocess) {
+		return Invocation::Preprocess;
+	}
+
+	size_t sources = 0;
+	forEachSource(argv, argc, [&](size_t i) {
+		conftest = conftest || isConftest(argv[i]);
+		sources++;
+	});
+
+	// CMake runs real compiles and links in the build tree, never inside
+	// CMakeFiles/; probes that link count as probes, not as links
+	if (conftest || cwd.find("/CMakeFiles/") != std::string_view::npos ||
+	    cwd.find("/meson-private") != std::string_view::npos) {
+		return Invocation::Probe;
+	}
+	if (sources == 0) {
+		return responseFile ? Invocation::ResponseFile : Invocation::NoSources;
+	}
+
+	return Invocation::Compile;
+}
+
+static constexpr std::string_view exampleCompile[] = {"gcc", "-c", "a.c", "-o", "a.o"};
+static constexpr std::string_view exampleValues[] = {"gcc", "-include", "p.h", "-MF", "a.d", "a.cc", "b.S"};
+static constexpr std::string_view exampleLanguage[] = {"gcc", "-x", "c", "conftest", "-x", "none", "b.o"};
+static constexpr std::string_view exampleLink[] = {"gcc", "a.o", "dir.c/b", "-lm", "-"};
+
+static_assert(countSources(exampleCompile, 5) == 1 && countSources(exampleValues, 7) == 2);
+static_assert(countSources(exampleLanguage, 7) == 1 && countSources(exampleLink, 5) == 0);
+
+static constexpr std::string_view examplePreprocess[] = {"gcc", "-E", "-dM", "a.c"};
+static constexpr std::string_view exampleVersion[] = {"gcc", "--version"};
+static constexpr std::string_view exampleFrontend[] = {"clang", "-cc1", "-triple", "x86_64", "a.c"};
+
+static_assert(classify(exampleCompile, 5, "/src") == Invocation::Compile);
+static_assert(classify(exampleCompile, 5, "/src/build/CMakeFiles/CMakeScratch/TryCompile-x") == Invocation::Probe);
+static_assert(classify(exampleLink, 5, "/src") == Invocation::NoSources);
+static_assert(classify(exampleLink, 5, "/src/build/CMakeFiles/CMakeScratch/TryCompile-x") == Invocation::Probe);
+static_assert(classify(examplePreprocess, 4, "/src") == Invocation::Preprocess);
+static_assert(classify(exampleVersion, 2, "/src") == Invocation::Query);
+static_assert(classify(exampleFrontend, 5, "/src") == Invocation::Frontend);
+static_assert(classify(exampleLanguage, 7, "/src") == Invocation::Probe);
+
+static constexpr std::string_view exampleResponseFile[] = {"gcc", "@CMakeFiles/app.dir/flags.rsp"};
+static_assert(classify(exampleResponseFile, 2, "/src") == Invocation::ResponseFile);
+
+} // namespace compiler_args
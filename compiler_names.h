@@ -0,0 +1,112 @@
+#include <cstdint>
+#include <string_view>
+
+#pragma once
+
+// Compiler names ec knows about. Each of them also matches with a version
+// suffix (gcc-13, clang++-17.0) and a target prefix (x86_64-linux-gnu-g++),
+// both for dispatch in main and for the PATH scan in invocateBuild. More names
+// can be compiled in with e.g. make EXTRA_COMPILER_NAMES='"icx","icpx"'.
+#ifndef EC_EXTRA_COMPILER_NAMES
+#define EC_EXTRA_COMPILER_NAMES
+#endif
+
+static constexpr std::string_view compilerNames[] = {
+	"cc", "c++", "gcc", "g++", "clang", "clang++", EC_EXTRA_COMPILER_NAMES
+};
+
+static constexpr size_t compilerNameCount = sizeof(compilerNames) / sizeof(compilerNames[0]);
+
+// Perfect hash over compilerNames, found by the compiler: the table has at
+// least twice as many slots as there are names and the seed is the first one
+// under which no two names collide. Nothing is built at runtime, a lookup is
+// one hash and one string compare.
+namespace compiler_name_hash {
+
+constexpr uint32_t hash(std::string_view name, uint32_t seed) {
+	uint32_t h = 2166136261u ^ seed;
+	for (char c : name) {
+		h = (h ^ static_cast<uint8_t>(c)) * 16777619u;
+	}
+	return h ^ (h >> 15);
+}
+
+constexpr size_t tableSize() {
+	size_t size = 1;
+	while (size < 2 * compilerNameCount) {
+		size *= 2;
+	}
+	return size;
+}
+
+constexpr uint32_t findSeed() {
+	for (uint32_t seed = 0;; seed++) {
+		bool used[tableSize()] = {};
+		bool collision = false;
+		for (std::string_view name : compilerNames) {
+			size_t slot = hash(name, seed) & (tableSize() - 1);
+			collision = collision || used[slot];
+			used[slot] = true;
+		}
+		if (!collision) {
+			return seed;
+		}
+	}
+}
+
+static constexpr uint32_t seed = findSeed();
+
+struct Table {
+	int8_t slots[tableSize()];
+};
+
+constexpr Table buildTable() {
+	Table table{};
+	for (size_t i = 0; i < tableSize(); i++) {
+		table.slots[i] = -1;
+	}
+	for (size_t i = 0; i < compilerNameCount; i++) {
+		table.slots[hash(compilerNames[i], seed) & (tableSize() - 1)] = static_cast<int8_t>(i);
+	}
+	return table;
+}
+
+static constexpr Table table = buildTable();
+
+static_assert(compilerNameCount < 128, "slots are int8_t");
+
+} // namespace compiler_name_hash
+
+constexpr bool isKnownCompilerName(std::string_view name) {
+	using namespace compiler_name_hash;
+	int8_t index = table.slots[hash(name, seed) & (tableSize() - 1)];
+	return index >= 0 && compilerNames[index] == name;
+}
+
+// name, name-<digit>..., <prefix>-name or <prefix>-name-<digit>... for one of
+// the known names
+constexpr bool isCompilerName(std::string_view name) {
+	size_t start = 0;
+	while (true) {
+		// no substr(): it can throw, and ec-preload.so must not pull in libstdc++
+		std::string_view rest{name.data() + start, name.size() - start};
+		if (isKnownCompilerName(rest)) {
+			return true;
+		}
+		for (size_t dash = rest.find('-'); dash != std::string_view::npos; dash = rest.find('-', dash + 1)) {
+			if (dash + 1 < rest.size() && rest[dash + 1] >= '0' && rest[dash + 1] <= '9' &&
+			    isKnownCompilerName(std::string_view{rest.data(), dash})) {
+				return true;
+			}
+		}
+
+		size_t dash = name.find('-', start);
+		if (dash == std::string_view::npos) {
+			return false;
+		}
+		start = dash + 1;
+	}
+}
+
+static_assert(isCompilerName("gcc") && isCompilerName("clang++-17") && isCompilerName("x86_64-linux-gnu-g++-12"));
+static_assert(!isCompilerName("gcc-ar") && !isCompilerName("clang-format") && !isCompilerName("ec"));
@@ -0,0 +1,445 @@
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+#include "ec_index.h"
+#include "entry_store.h"
+#include "json_writer.h"
+#include "util.h"
+
+#pragma once
+
+namespace fs = std::filesystem;
+
+// Splits a "command" string of an existing database the way a POSIX shell
+// would: blanks separate words, single quotes are literal, double quotes and
+// backslashes escape.
+inline std::vector<std::string> splitCommand(std::string_view command) {
+	std::vector<std::string> words;
+	std::string word;
+	bool inWord = false;
+	for (size_t i = 0; i < command.size(); i++) {
+		char c = command[i];
+		if (c == ' ' || c == '\t' || c == '\n') {
+			if (inWord) {
+				words.push_back(std::move(word));
+				word.clear();
+				inWord = false;
+			}
+			continue;
+		}
+
+		inWord = true;
+		if (c == '\'') {
+			for (i++; i < command.size() && command[i] != '\''; i++) {
+				word += command[i];
+			}
+		} else if (c == '"') {
+			for (i++; i < command.size() && command[i] != '"'; i++) {
+				if (command[i] == '\\' && i + 1 < command.size() && strchr("\"\\$`", command[i + 1]) != nullptr) {
+					i++;
+				}
+				word += command[i];
+			}
+		} else if (c == '\\' && i + 1 < command.size()) {
+			word += command[++i];
+		} else {
+			word += c;
+		}
+	}
+	if (inWord) {
+		words.push_back(std::move(word));
+	}
+
+	return words;
+}
+
+// Streams an existing compile_commands.json into an EntryStore without
+// building a DOM. Understands "arguments" as well as "command"; other keys are
+// skipped.
+class CompileCommandsReader : public nlohmann::json_sax<nlohmann::json> {
+public:
+	CompileCommandsReader(EntryStore &entries) : entries(entries) {
+	}
+
+	bool null() override {
+		return true;
+	}
+
+	bool boolean(bool) override {
+		return true;
+	}
+
+	bool number_integer(number_integer_t) override {
+		return true;
+	}
+
+	bool number_unsigned(number_unsigned_t) override {
+		return true;
+	}
+
+	bool number_float(number_float_t, const string_t&) override {
+		return true;
+	}
+
+	bool string(string_t &value) override {
+		if (depth == 3 && currentKey == "arguments") {
+			arguments.push_back(std::move(value));
+		} else if (depth == 2 && currentKey == "directory") {
+			directory = std::move(value);
+		} else if (depth == 2 && currentKey == "file") {
+			file = std::move(value);
+		} else if (depth == 2 && currentKey == "command") {
+			command = std::move(value);
+		}
+		return true;
+	}
+
+	bool start_object(std::size_t) override {
+		depth++;
+		if (depth == 2) {
+			directory.clear();
+			file.clear();
+			command.clear();
+			arguments.clear();
+		}
+		return true;
+	}
+
+	bool key(string_t &value) override {
+		if (depth == 2) {
+			currentKey = std::move(value);
+		}
+		return true;
+	}
+
+	bool end_object() override {
+		if (depth == 2) {
+			if (arguments.empty() && !command.empty()) {
+				arguments = splitCommand(command);
+			}
+			if (!arguments.empty()) {
+				entries.add(directory, file, arguments);
+			}
+		}
+		depth--;
+		return true;
+	}
+
+	bool start_array(std::size_t) override {
+		depth++;
+		return true;
+	}
+
+	bool end_array() override {
+		depth--;
+		return true;
+	}
+
+	bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception &e) override {
+		error = e.what();
+		return false;
+	}
+
+	std::string error;
+
+private:
+	EntryStore &entries;
+	int depth = 0;
+	std::string currentKey;
+	std::string directory;
+	std::string file;
+	std::string command;
+	std::vector<std::string> arguments;
+};
+
+// false with a message on stderr if path exists but is not a database; a
+// missing file is an empty database
+inline bool loadCompileCommands(const fs::path &path, EntryStore &entries) {
+	MappedFile database{path};
+	if (database.data() == nullptr) {
+		return true;
+	}
+
+	CompileCommandsReader reader{entries};
+	if (!nlohmann::json::sax_parse(database.data(), database.data() + database.size(), &reader)) {
+		std::cerr << "reading " << path << " failed: " << reader.error << std::endl;
+		return false;
+	}
+
+	return true;
+}
+
+
+// path made absolute against directory and normalized; only paths with ".",
+// ".." or "//" in them pay for std::filesystem
+inline void appendAbsolutePath(std::string &out, std::string_view directory, std::string_view path) {
+	size_t start = out.size();
+	if (path.empty() || path[0] != '/') {
+		out += directory;
+		out += '/';
+	}
+	out += path;
+
+	std::string_view joined{out.data() + start, out.size() - start};
+	bool plain = joined.find("//") == std::string_view::npos && joined.find("/.") == std::string_view::npos;
+	if (!plain) {
+		std::string normal = fs::path{std::string{joined}}.lexically_normal().string();
+		out.resize(start);
+		out += normal;
+	}
+}
+
+// directory and the absolute source path, so a relative and an absolute
+// spelling of the same file are the same key
+inline std::string sourceKey(const EntryStore &entries, const Entry &entry) {
+	std::string key{entries.directory(entry)};
+	key += '\0';
+	appendAbsolutePath(key, entries.directory(entry), entries.file(entry));
+	return key;
+}
+
+// What identifies a compile across runs: the same source compiled in the same
+// directory to the same output.
+inline std::string entryKey(const EntryStore &entries, const Entry &entry) {
+	std::string_view output;
+	for (const StringPool::Id *id = entries.argumentsBegin(entry); id != entries.argumentsEnd(entry); id++) {
+		std::string_view argument = entries.string(*id);
+		if (argument == "-o" && id + 1 != entries.argumentsEnd(entry)) {
+			output = entries.string(*++id);
+		} else if (argument.size() > 2 && argument.substr(0, 2) == "-o") {
+			output = argument.substr(2);
+		}
+	}
+
+	std::string key = sourceKey(entries, entry);
+	key += '\0';
+	if (!output.empty()) {
+		appendAbsolutePath(key, entries.directory(entry), output);
+	}
+	return key;
+}
+
+// Writes the ec_index.h companion of a database holding selection. Strings are
+// renumbered, so an index of a shard only carries the strings of its own
+// entries.
+inline void writeIndex(const fs::path &path, const EntryStore &entries, const std::vector<Entry> &selection) {
+	using namespace ec_index;
+
+	StringPool strings;
+	std::vector<IndexEntry> indexEntries;
+	std::vector<uint32_t> argumentIds;
+	std::string source;
+	for (const Entry &entry : selection) {
+		source.clear();
+		appendAbsolutePath(source, entries.directory(entry), entries.file(entry));
+
+		IndexEntry indexEntry;
+		indexEntry.path = strings.intern(source);
+		indexEntry.directory = strings.intern(entries.directory(entry));
+		indexEntry.file = strings.intern(entries.file(entry));
+		indexEntry.argumentsBegin = argumentIds.size();
+		indexEntry.argumentCount = entry.argumentCount;
+		for (const StringPool::Id *id = entries.argumentsBegin(entry); id != entries.argumentsEnd(entry); id++) {
+			argumentIds.push_back(strings.intern(entries.string(*id)));
+		}
+		indexEntries.push_back(indexEntry);
+	}
+
+	std::stable_sort(indexEntries.begin(), indexEntries.end(), [&strings](const IndexEntry &a, const IndexEntry &b) {
+		return strings[a.path] < strings[b.path];
+	});
+
+	std::vector<IndexString> stringTable;
+	uint64_t stringBytes = 0;
+	for (size_t id = 0; id < strings.size(); id++) {
+		stringTable.push_back({static_cast<uint32_t>(stringBytes), static_cast<uint32_t>(strings[id].size())});
+		stringBytes += strings[id].size();
+	}
+	if (stringBytes > UINT32_MAX) {
+		std::cerr << "not writing " << path << ": more than 4 GiB of strings" << std::endl;
+		return;
+	}
+
+	IndexHeader header{};
+	memcpy(header.magic, magic, sizeof(magic));
+	header.version = version;
+	header.entryCount = indexEntries.size();
+	header.stringCount = stringTable.size();
+	header.argumentCount = argumentIds.size();
+	header.stringBytes = stringBytes;
+	header.stringsOffset = sizeof(IndexHeader);
+	header.argumentsOffset = header.stringsOffset + stringTable.size() * sizeof(IndexString);
+	header.entriesOffset = header.argumentsOffset + argumentIds.size() * sizeof(uint32_t);
+	header.bytesOffset = header.entriesOffset + indexEntries.size() * sizeof(IndexEntry);
+
+	fs::path tmpPath = path.string() + ".tmp";
+	{
+		std::ofstream out{tmpPath, std::ios::binary};
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.write(reinterpret_cast<const char*>(stringTable.data()), stringTable.size() * sizeof(IndexString));
+		out.write(reinterpret_cast<const char*>(argumentIds.data()), argumentIds.size() * sizeof(uint32_t));
+		out.write(reinterpret_cast<const char*>(indexEntries.data()), indexEntries.size() * sizeof(IndexEntry));
+		for (size_t id = 0; id < strings.size(); id++) {
+			out.write(strings[id].data(), strings[id].size());
+		}
+		if (!out.flush()) {
+			std::cerr << "writing " << tmpPath << " failed" << std::endl;
+			exit(-1);
+		}
+	}
+	fs::rename(tmpPath, path);
+}
+
+// Writes path and its index, path with .idx instead of .json
+inline void writeCompileCommands(const fs::path &path, const EntryStore &entries, const std::vector<Entry> &selection,
+                                 int indent) {
+	CompileCommandsWriter json{path, indent};
+	std::vector<std::string_view> arguments;
+	for (const Entry &entry : selection) {
+		entries.arguments(entry, arguments);
+		json.entry(entries.directory(entry), entries.file(entry), arguments);
+	}
+	json.finish();
+
+	writeIndex(fs::path{path}.replace_extension(".idx"), entries, selection);
+}
+
+// The first loaded entries of entries came from the existing database, the
+// rest were captured now. A captured entry takes the place of the existing one
+// with the same key, anything new is appended, so unchanged parts of the
+// database keep their order.
+inline void mergeCaptured(EntryStore &entries, size_t loaded) {
+	const std::vector<Entry> &all = entries.all();
+
+	std::unordered_map<std::string, size_t> existing;
+	existing.reserve(loaded);
+	for (size_t i = 0; i < loaded; i++) {
+		existing.emplace(entryKey(entries, all[i]), i);
+	}
+
+	std::vector<Entry> merged{all.begin(), all.begin() + loaded};
+	std::vector<bool> replaced(loaded);
+	for (size_t i = loaded; i < all.size(); i++) {
+		auto match = existing.find(entryKey(entries, all[i]));
+		if (match != existing.end() && !replaced[match->second]) {
+			merged[match->second] = all[i];
+			replaced[match->second] = true;
+		} else {
+			merged.push_back(all[i]);
+		}
+	}
+
+	entries.assign(std::move(merged));
+}
+
+// What to do with a source that was compiled more than once, e.g. as PIC and
+// non-PIC object or for several targets.
+enum class DedupPolicy {
+	// keep every compile
+	All,
+	// keep the first compile of every source
+	First,
+	// keep the last compile of every source
+	Last,
+	// keep one compile per source and set of flags; flags naming outputs
+	// (-o, -MF, -MT, -MQ) do not count
+	Distinct,
+};
+
+// -o, -MF, -MT and -MQ name what a compile writes, not how it compiles: 2 if
+// the value is the next argument, 1 if it is joined, 0 for other arguments
+inline int outputOption(std::string_view argument) {
+	if (argument == "-o" || argument == "-MF" || argument == "-MT" || argument == "-MQ") {
+		return 2;
+	}
+	if (argument.size() > 2 && (argument.substr(0, 2) == "-o" || argument.substr(0, 3) == "-MF" ||
+	                            argument.substr(0, 3) == "-MT" || argument.substr(0, 3) == "-MQ")) {
+		return 1;
+	}
+	return 0;
+}
+
+// the arguments of entry that decide how the source is compiled, as a string
+// of ids
+inline std::string flagSetKey(const EntryStore &entries, const Entry &entry) {
+	std::string key;
+	for (const StringPool::Id *id = entries.argumentsBegin(entry); id != entries.argumentsEnd(entry); id++) {
+		// the source itself may be spelled differently
+		if (*id == entry.file) {
+			continue;
+		}
+		int output = outputOption(entries.string(*id));
+		if (output == 2) {
+			id += id + 1 != entries.argumentsEnd(entry);
+			continue;
+		}
+		if (output == 1) {
+			continue;
+		}
+		key.append(reinterpret_cast<const char*>(id), sizeof(*id));
+	}
+	return key;
+}
+
+// What --dedup counts as the same source: its absolute path alone, so that
+// a.c compiled from two build directories is still one source
+inline std::string dedupKey(const EntryStore &entries, const Entry &entry) {
+	std::string key;
+	appendAbsolutePath(key, entries.directory(entry), entries.file(entry));
+	return key;
+}
+
+// One pass over all entries with a hash set of what was seen; the survivors
+// keep their relative order.
+inline void deduplicate(EntryStore &entries, DedupPolicy policy) {
+	if (policy == DedupPolicy::All) {
+		return;
+	}
+
+	const std::vector<Entry> &all = entries.all();
+	std::vector<Entry> kept;
+	if (policy == DedupPolicy::Last) {
+		// the last one wins, so the kept slot of a key gets overwritten
+		std::unordered_map<std::string, size_t> slots;
+		slots.reserve(all.size());
+		std::vector<bool> superseded;
+		for (const Entry &entry : all) {
+			auto [slot, inserted] = slots.try_emplace(dedupKey(entries, entry), kept.size());
+			if (!inserted) {
+				superseded[slot->second] = true;
+				slot->second = kept.size();
+			}
+			kept.push_back(entry);
+			superseded.push_back(false);
+		}
+		size_t used = 0;
+		for (size_t i = 0; i < kept.size(); i++) {
+			if (!superseded[i]) {
+				kept[used++] = kept[i];
+			}
+		}
+		kept.resize(used);
+	} else {
+		std::unordered_map<std::string, bool> seen;
+		seen.reserve(all.size());
+		for (const Entry &entry : all) {
+			std::string key = dedupKey(entries, entry);
+			if (policy == DedupPolicy::Distinct) {
+				key += '\0';
+				key += flagSetKey(entries, entry);
+			}
+			if (seen.emplace(std::move(key), true).second) {
+				kept.push_back(entry);
+			}
+		}
+	}
+
+	entries.assign(std::move(kept));
+}
@@ -0,0 +1,178 @@
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "nlohmann/json.hpp"
+#include "database.h"
+#include "entry_store.h"
+#include "json_writer.h"
+#include "util.h"
+
+#pragma once
+
+namespace fs = std::filesystem;
+
+// --dictionary writes compile_commands.dict.json instead of
+// compile_commands.json. The compiles of a build differ in little more than
+// their source and output names, so every distinct command line is stored
+// once as a flag set with holes, and an entry only carries what goes into the
+// holes:
+//
+//   {
+//   "version": 1,
+//   "directories": ["/src/build", ...],
+//   "flagSets": [
+//   ["/usr/bin/gcc", "-O2", "-c", 0, "-o", null],
+//   ...],
+//   "entries": [
+//   [0, "a.c", 0, "a.o"],
+//   ...]
+//   }
+//
+// An entry is [directory id, file, flag set id, values...]. In a flag set, 0
+// stands for the file of the entry and each null for its next value. `ec
+// expand` turns the dictionary back into a plain compile_commands.json.
+static constexpr const char *dictionaryName = "compile_commands.dict.json";
+
+// The holes of a flag set, as ids that no string can have
+static constexpr StringPool::Id dictionaryFileHole = UINT32_MAX;
+static constexpr StringPool::Id dictionaryValueHole = UINT32_MAX - 1;
+
+// entry's arguments with holes, as a string of ids, and the values that go
+// into them
+inline void splitFlagSet(const EntryStore &entries, const Entry &entry, std::string &flagSet,
+                         std::vector<StringPool::Id> &values) {
+	flagSet.clear();
+	values.clear();
+	for (const StringPool::Id *id = entries.argumentsBegin(entry); id != entries.argumentsEnd(entry); id++) {
+		StringPool::Id hole = *id;
+		int output = outputOption(entries.string(*id));
+		if (*id == entry.file) {
+			hole = dictionaryFileHole;
+		} else if (output == 1) {
+			hole = dictionaryValueHole;
+			values.push_back(*id);
+		} else if (output == 2 && id + 1 != entries.argumentsEnd(entry)) {
+			flagSet.append(reinterpret_cast<const char*>(id), sizeof(*id));
+			id++;
+			hole = dictionaryValueHole;
+			values.push_back(*id);
+		}
+		flagSet.append(reinterpret_cast<const char*>(&hole), sizeof(hole));
+	}
+}
+
+// Two passes over selection: the first numbers the directories and flag
+// sets, which come first in the file, the second streams the entries, so
+// memory only grows with the distinct command lines.
+inline void writeDictionary(const fs::path &path, const EntryStore &entries, const std::vector<Entry> &selection) {
+	std::unordered_map<StringPool::Id, uint32_t> directories;
+	std::vector<StringPool::Id> directoryOrder;
+	std::unordered_map<std::string, uint32_t> flagSets;
+	std::vector<std::string> flagSetOrder;
+	std::vector<uint32_t> entryFlagSets;
+	entryFlagSets.reserve(selection.size());
+
+	std::string flagSet;
+	std::vector<StringPool::Id> values;
+	for (const Entry &entry : selection) {
+		splitFlagSet(entries, entry, flagSet, values);
+		if (directories.try_emplace(entry.directory, directoryOrder.size()).second) {
+			directoryOrder.push_back(entry.directory);
+		}
+		auto set = flagSets.try_emplace(flagSet, flagSetOrder.size()).first;
+		if (set->second == flagSetOrder.size()) {
+			flagSetOrder.push_back(flagSet);
+		}
+		entryFlagSets.push_back(set->second);
+	}
+
+	JsonOutput out{path};
+	out.put("{\n\"version\": 1,\n\"directories\": [");
+	for (size_t i = 0; i < directoryOrder.size(); i++) {
+		out.put(i == 0 ? "" : ", ");
+		out.string(entries.string(directoryOrder[i]));
+	}
+	out.put("],\n\"flagSets\": [");
+	for (size_t i = 0; i < flagSetOrder.size(); i++) {
+		out.put(i == 0 ? "\n[" : ",\n[");
+		const StringPool::Id *ids = reinterpret_cast<const StringPool::Id*>(flagSetOrder[i].data());
+		for (size_t j = 0; j < flagSetOrder[i].size() / sizeof(StringPool::Id); j++) {
+			out.put(j == 0 ? "" : ", ");
+			if (ids[j] == dictionaryFileHole) {
+				out.put('0');
+			} else if (ids[j] == dictionaryValueHole) {
+				out.put("null");
+			} else {
+				out.string(entries.string(ids[j]));
+			}
+		}
+		out.put(']');
+	}
+	out.put("],\n\"entries\": [");
+	for (size_t i = 0; i < selection.size(); i++) {
+		const Entry &entry = selection[i];
+		splitFlagSet(entries, entry, flagSet, values);
+		out.put(i == 0 ? "\n[" : ",\n[");
+		out.number(directories[entry.directory]);
+		out.put(',');
+		out.string(entries.file(entry));
+		out.put(',');
+		out.number(entryFlagSets[i]);
+		for (StringPool::Id value : values) {
+			out.put(',');
+			out.string(entries.string(value));
+		}
+		out.put(']');
+	}
+	out.put("]\n}\n");
+	out.finish();
+}
+
+// Expands every entry of the dictionary at path into entries; a missing file
+// is an empty database.
+inline bool loadDictionary(const fs::path &path, EntryStore &entries) {
+	MappedFile file{path};
+	if (file.data() == nullptr) {
+		return true;
+	}
+
+	nlohmann::json dictionary = nlohmann::json::parse(file.data(), file.data() + file.size(), nullptr, false);
+	if (dictionary.is_discarded() || !dictionary.is_object() || !dictionary["directories"].is_array() || !dictionary["flagSets"].is_array() ||
+	    !dictionary["entries"].is_array()) {
+		std::cerr << "reading " << path << " failed" << std::endl;
+		return false;
+	}
+	const nlohmann::json &directories = dictionary["directories"];
+	const nlohmann::json &flagSets = dictionary["flagSets"];
+
+	std::vector<std::string> arguments;
+	for (const nlohmann::json &entry : dictionary["entries"]) {
+		if (!entry.is_array() || entry.size() < 3 || !entry[0].is_number_unsigned() || entry[0] >= directories.size() ||
+		    !entry[1].is_string() || !entry[2].is_number_unsigned() || entry[2] >= flagSets.size()) {
+			std::cerr << "reading " << path << " failed: malformed entry " << entry.dump() << std::endl;
+			return false;
+		}
+
+		arguments.clear();
+		size_t value = 3;
+		for (const nlohmann::json &argument : flagSets[entry[2].get<size_t>()]) {
+			if (argument.is_string()) {
+				arguments.push_back(argument.get<std::string>());
+			} else if (argument.is_number()) {
+				arguments.push_back(entry[1].get<std::string>());
+			} else if (value < entry.size() && entry[value].is_string()) {
+				arguments.push_back(entry[value++].get<std::string>());
+			} else {
+				std::cerr << "reading " << path << " failed: entry " << entry.dump() << " misses values" << std::endl;
+				return false;
+			}
+		}
+		entries.add(directories[entry[0].get<size_t>()].get<std::string>(), entry[1].get<std::string>(), arguments);
+	}
+
+	return true;
+}
@@ -0,0 +1,200 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#pragma once
+
+// Binary companion of compile_commands.json, written next to it as
+// compile_commands.idx. Everything is little endian and 4 byte aligned, so a
+// reader maps the file and looks entries up in place:
+//
+//   IndexHeader
+//   IndexString[stringCount]    offset and length into the string bytes
+//   uint32_t[argumentCount]     string ids, the arguments of all entries
+//   IndexEntry[entryCount]      sorted by path
+//   char[stringBytes]           every distinct string once
+//
+// path is the absolute, normalized source of an entry. Looking up a file or
+// all files below a directory is a binary search over the entries.
+//
+// This header only needs libc and the C++ standard library; tools can copy it
+// and use IndexReader without anything else from ec.
+namespace ec_index {
+
+static constexpr char magic[8] = {'E', 'C', 'I', 'N', 'D', 'E', 'X', '1'};
+static constexpr uint32_t version = 1;
+
+struct IndexHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t entryCount;
+	uint32_t stringCount;
+	uint32_t reserved;
+	uint64_t argumentCount;
+	uint64_t stringBytes;
+	uint64_t stringsOffset;
+	uint64_t argumentsOffset;
+	uint64_t entriesOffset;
+	uint64_t bytesOffset;
+};
+
+struct IndexString {
+	uint32_t offset;
+	uint32_t length;
+};
+
+struct IndexEntry {
+	uint32_t path;
+	uint32_t directory;
+	uint32_t file;
+	uint32_t argumentsBegin;
+	uint32_t argumentCount;
+};
+
+static_assert(sizeof(IndexHeader) == 72 && sizeof(IndexString) == 8 && sizeof(IndexEntry) == 20,
+              "the layout is the file format");
+
+class IndexReader {
+public:
+	using Range = std::pair<const IndexEntry*, const IndexEntry*>;
+
+	IndexReader() = default;
+	IndexReader(const IndexReader&) = delete;
+	IndexReader &operator=(const IndexReader&) = delete;
+
+	~IndexReader() {
+		if (mapping != nullptr) {
+			munmap(mapping, mappedSize);
+		}
+	}
+
+	// false if path cannot be mapped or is not an index
+	bool open(const char *path) {
+		int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			return false;
+		}
+		struct stat st;
+		if (fstat(fd, &st) < 0 || static_cast<uint64_t>(st.st_size) < sizeof(IndexHeader)) {
+			close(fd);
+			return false;
+		}
+		mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (mapping == MAP_FAILED) {
+			mapping = nullptr;
+			return false;
+		}
+		mappedSize = st.st_size;
+
+		const char *base = static_cast<const char*>(mapping);
+		header = reinterpret_cast<const IndexHeader*>(base);
+		if (memcmp(header->magic, magic, sizeof(magic)) != 0 || header->version != version ||
+		    !fits(header->stringsOffset, header->stringCount, sizeof(IndexString)) ||
+		    !fits(header->argumentsOffset, header->argumentCount, sizeof(uint32_t)) ||
+		    !fits(header->entriesOffset, header->entryCount, sizeof(IndexEntry)) ||
+		    !fits(header->bytesOffset, header->stringBytes, 1)) {
+			header = nullptr;
+			return false;
+		}
+		strings = reinterpret_cast<const IndexString*>(base + header->stringsOffset);
+		arguments = reinterpret_cast<const uint32_t*>(base + header->argumentsOffset);
+		entries = reinterpret_cast<const IndexEntry*>(base + header->entriesOffset);
+		bytes = base + header->bytesOffset;
+
+		return true;
+	}
+
+	size_t size() const {
+		return header == nullptr ? 0 : header->entryCount;
+	}
+
+	Range all() const {
+		return {entries, entries + size()};
+	}
+
+	// entries compiling exactly this absolute path
+	Range findFile(std::string_view path) const {
+		return std::equal_range(entries, entries + size(), path, PathLess{this});
+	}
+
+	// entries of all sources below the directory dir
+	Range findDirectory(std::string_view dir) const {
+		std::string prefix{dir};
+		while (prefix.size() > 1 && prefix.back() == '/') {
+			prefix.pop_back();
+		}
+		if (prefix != "/") {
+			prefix += '/';
+		}
+
+		const IndexEntry *first = std::lower_bound(entries, entries + size(), prefix, PathLess{this});
+		const IndexEntry *last = first;
+		while (last != entries + size() && string(last->path).compare(0, prefix.size(), prefix) == 0) {
+			last++;
+		}
+		return {first, last};
+	}
+
+	std::string_view string(uint32_t id) const {
+		if (id >= header->stringCount || strings[id].offset + static_cast<uint64_t>(strings[id].length) > header->stringBytes) {
+			return {};
+		}
+		return {bytes + strings[id].offset, strings[id].length};
+	}
+
+	std::string_view path(const IndexEntry &entry) const {
+		return string(entry.path);
+	}
+
+	std::string_view directory(const IndexEntry &entry) const {
+		return string(entry.directory);
+	}
+
+	std::string_view file(const IndexEntry &entry) const {
+		return string(entry.file);
+	}
+
+	size_t argumentCount(const IndexEntry &entry) const {
+		return entry.argumentsBegin + static_cast<uint64_t>(entry.argumentCount) > header->argumentCount ? 0 : entry.argumentCount;
+	}
+
+	// argument i of entry; 0 is the compiler
+	std::string_view argument(const IndexEntry &entry, size_t i) const {
+		return string(arguments[entry.argumentsBegin + i]);
+	}
+
+private:
+	struct PathLess {
+		const IndexReader *reader;
+
+		bool operator()(const IndexEntry &entry, std::string_view path) const {
+			return reader->string(entry.path) < path;
+		}
+
+		bool operator()(std::string_view path, const IndexEntry &entry) const {
+			return path < reader->string(entry.path);
+		}
+	};
+
+	bool fits(uint64_t offset, uint64_t count, uint64_t size) const {
+		return offset % 4 == 0 && offset <= mappedSize && count <= (mappedSize - offset) / size;
+	}
+
+	void *mapping = nullptr;
+	size_t mappedSize = 0;
+	const IndexHeader *header = nullptr;
+	const IndexString *strings = nullptr;
+	const uint32_t *arguments = nullptr;
+	const IndexEntry *entries = nullptr;
+	const char *bytes = nullptr;
+};
+
+} // namespace ec_index
@@ -0,0 +1,207 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#pragma once
+
+// Holds every ingested compile command until the database is written. A build
+// repeats the same directories, compiler paths and flags over and over, so
+// each distinct string is stored once in an arena and entries refer to it by
+// a 32 bit id; memory grows with the unique content of the build, not with
+// the number of compiles.
+
+// Bump allocator, nothing is freed before the arena itself.
+class Arena {
+public:
+	Arena() = default;
+	Arena(const Arena&) = delete;
+	Arena &operator=(const Arena&) = delete;
+
+	std::string_view copy(std::string_view s) {
+		if (s.empty()) {
+			return {};
+		}
+		if (s.size() > left) {
+			size_t size = std::max(blockSize, s.size());
+			blocks.emplace_back(new char[size]);
+			next = blocks.back().get();
+			left = size;
+		}
+		memcpy(next, s.data(), s.size());
+		std::string_view copied{next, s.size()};
+		next += s.size();
+		left -= s.size();
+		return copied;
+	}
+
+private:
+	static constexpr size_t blockSize = 1 << 20;
+
+	std::vector<std::unique_ptr<char[]>> blocks;
+	char *next = nullptr;
+	size_t left = 0;
+};
+
+// Interning table: open addressing over ids, with the hash kept next to the
+// id so that probing rarely has to look at the strings.
+class StringPool {
+public:
+	using Id = uint32_t;
+
+	Id intern(std::string_view s) {
+		if (2 * (strings.size() + 1) > slots.size()) {
+			grow();
+		}
+
+		uint32_t hash = static_cast<uint32_t>(std::hash<std::string_view>{}(s));
+		for (size_t i = hash & (slots.size() - 1);; i = (i + 1) & (slots.size() - 1)) {
+			Slot &slot = slots[i];
+			if (slot.id == noId) {
+				slot = {hash, static_cast<Id>(strings.size())};
+				strings.push_back(arena.copy(s));
+				return slot.id;
+			}
+			if (slot.hash == hash && strings[slot.id] == s) {
+				return slot.id;
+			}
+		}
+	}
+
+	std::string_view operator[](Id id) const {
+		return strings[id];
+	}
+
+	size_t size() const {
+		return strings.size();
+	}
+
+private:
+	static constexpr Id noId = UINT32_MAX;
+
+	struct Slot {
+		uint32_t hash;
+		Id id = noId;
+	};
+
+	void grow() {
+		std::vector<Slot> old = std::move(slots);
+		slots.assign(old.empty() ? 1024 : 2 * old.size(), Slot{});
+		for (const Slot &slot : old) {
+			if (slot.id == noId) {
+				continue;
+			}
+			size_t i = slot.hash & (slots.size() - 1);
+			while (slots[i].id != noId) {
+				i = (i + 1) & (slots.size() - 1);
+			}
+			slots[i] = slot;
+		}
+	}
+
+	Arena arena;
+	std::vector<std::string_view> strings;
+	std::vector<Slot> slots;
+};
+
+// One compile command. arguments[0] is the real compiler, the rest is what it
+// was called with.
+struct Entry {
+	StringPool::Id directory;
+	StringPool::Id file;
+	uint32_t argumentsBegin;
+	uint32_t argumentCount;
+};
+
+class EntryStore {
+public:
+	// RecordType is a Record or RecordView (record.h): the wrapper saw the name
+	// the compiler was invoked as, the database wants exe in its place. One
+	// entry per source, all sharing the same arguments; without a source the
+	// directory stands in for the file.
+	template<typename RecordType>
+	void add(const RecordType &record) {
+		Entry entry;
+		entry.directory = strings.intern(record.cwd);
+		entry.argumentsBegin = static_cast<uint32_t>(argumentIds.size());
+		entry.argumentCount = static_cast<uint32_t>(std::max<size_t>(record.argv.size(), 1));
+		argumentIds.push_back(strings.intern(record.exe));
+		for (size_t i = 1; i < record.argv.size(); i++) {
+			argumentIds.push_back(strings.intern(record.argv[i]));
+		}
+
+		if (record.sources.empty()) {
+			entry.file = entry.directory;
+			entries.push_back(entry);
+		}
+		for (uint32_t source : record.sources) {
+			entry.file = argumentIds[entry.argumentsBegin + source];
+			entries.push_back(entry);
+		}
+	}
+
+	// arguments[0] is the compiler
+	template<typename Args>
+	void add(std::string_view directory, std::string_view file, const Args &arguments) {
+		Entry entry;
+		entry.directory = strings.intern(directory);
+		entry.file = strings.intern(file);
+		entry.argumentsBegin = static_cast<uint32_t>(argumentIds.size());
+		entry.argumentCount = 0;
+		for (const auto &argument : arguments) {
+			argumentIds.push_back(strings.intern(argument));
+			entry.argumentCount++;
+		}
+		entries.push_back(entry);
+	}
+
+	// replaces the list of entries, e.g. with a merged or filtered one; the
+	// strings and arguments they refer to stay where they are
+	void assign(std::vector<Entry> &&replacement) {
+		entries = std::move(replacement);
+	}
+
+	const std::vector<Entry> &all() const {
+		return entries;
+	}
+
+	size_t size() const {
+		return entries.size();
+	}
+
+	std::string_view string(StringPool::Id id) const {
+		return strings[id];
+	}
+
+	std::string_view directory(const Entry &entry) const {
+		return strings[entry.directory];
+	}
+
+	std::string_view file(const Entry &entry) const {
+		return strings[entry.file];
+	}
+
+	const StringPool::Id *argumentsBegin(const Entry &entry) const {
+		return argumentIds.data() + entry.argumentsBegin;
+	}
+
+	const StringPool::Id *argumentsEnd(const Entry &entry) const {
+		return argumentsBegin(entry) + entry.argumentCount;
+	}
+
+	// resolves the arguments of entry into out, which is reused by the caller
+	void arguments(const Entry &entry, std::vector<std::string_view> &out) const {
+		out.clear();
+		for (const StringPool::Id *id = argumentsBegin(entry); id != argumentsEnd(entry); id++) {
+			out.push_back(strings[*id]);
+		}
+	}
+
+private:
+	StringPool strings;
+	std::vector<StringPool::Id> argumentIds;
+	std::vector<Entry> entries;
+};
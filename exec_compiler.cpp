@@ -4,26 +4,48 @@
 #include <string>
 #include <vector>
 #include <set>
+#include <map>
+#include <algorithm>
+#include <atomic>
+#include <sstream>
 #include <cstring>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
 
 #include <sys/types.h>
-#include <sys/file.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <sys/mount.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
 #include <linux/limits.h>
+#include <dirent.h>
+#include <fnmatch.h>
 #include <unistd.h>
 #include <fcntl.h>
 
-#include "nlohmann/json.hpp"
 #include "util.h"
+#include "json_writer.h"
+#include "entry_store.h"
+#include "database.h"
+#include "ec_index.h"
+#include "shards.h"
+#include "dictionary.h"
+#include "live.h"
+#include "response_files.h"
+#include "ring.h"
+#include "record.h"
+#include "capture.h"
+#include "compiler_names.h"
+#include "seccomp.h"
 
 namespace fs = std::filesystem;
 
-static std::string execLogPrefix{"exec.log."};
-
-static std::set<std::string> compilerInvocations{"clang", "clang++", "gcc", "cc", "c++", "g++"};
-
 fs::path ownPath() {
 	char buf[PATH_MAX];
 
@@ -44,177 +66,655 @@ fs::path ownDir() {
 	return ownPath().parent_path();
 }
 
-fs::path getOriginalPath(const std::string &exe) {
-	std::set<fs::path> envPaths;
+// The static ec-shim next to ec is what gets mounted over the compilers; ec
+// can stand in for it, it just starts a lot slower.
+fs::path shimPath() {
+	fs::path shim = ownDir() / "ec-shim";
+	if (access(shim.string().c_str(), X_OK) == 0) {
+		return fs::canonical(shim);
+	}
 
-	std::string pathEnvVar = std::string{getenv("PATH")};
+	return fs::canonical(ownPath());
+}
 
-	std::stringstream ss(pathEnvVar);
-	std::string pathElem;
-	//envPaths.insert("/bin");
-	while(std::getline(ss, pathElem, ':')) {
-		envPaths.insert(pathElem);
+fs::path preloadPath() {
+	fs::path preload = ownDir() / "ec-preload.so";
+	if (access(preload.string().c_str(), R_OK) != 0) {
+		std::cerr << preload << " not found, it is needed for --preload" << std::endl;
+		exit(-1);
 	}
 
-	fs::path newExePath;
-	for (const fs::path &path : envPaths) {
-		newExePath = path / exe;
+	return fs::canonical(preload);
+}
+
+static size_t recordRingCapacity = 64 << 20;
 
-		if (!access(newExePath.string().c_str(), X_OK)) {
-			break;
+enum class Transport {
+	Files,
+	Append,
+	Socket,
+	Ring,
+};
+
+// How compiler executions are caught: by mounting ec-shim over the compilers
+// in a private mount namespace, by preloading ec-preload.so into the build,
+// which hooks the exec functions and needs no namespaces at all, or by
+// supervising every exec through a seccomp filter (see seccomp.h).
+enum class Interception {
+	Mounts,
+	Preload,
+	Seccomp,
+};
+
+struct BuildOptions {
+	Interception interception = Interception::Mounts;
+	Transport transport = Transport::Files;
+	// fnmatch() patterns from --compilers, on top of isCompilerName()
+	std::vector<std::string> compilerPatterns;
+	// 0 writes compile_commands.json without newlines
+	int indent = 4;
+	// update the existing compile_commands.json instead of replacing it
+	bool merge = false;
+	DedupPolicy dedup = DedupPolicy::All;
+	// > 0 writes compile_commands.d/ instead, see shards.h
+	int shardDepth = 0;
+	// write compile_commands.dict.json instead, see dictionary.h
+	bool dictionary = false;
+	// > 0 republishes the database every liveInterval seconds during the build
+	int liveInterval = 0;
+	// record link steps, -E, --version, configure probes, ... as well
+	bool allInvocations = false;
+	// the wrappers fake the compiles instead of running them, see fakeCompile()
+	bool noCompile = false;
+};
+
+struct PathMatch {
+	std::string name;
+	fs::path origPath;
+	dev_t dev;
+	ino_t ino;
+};
+
+// A compiler binary gets mounted once no matter how many names lead to it:
+// its real self goes to CC_BINDIR/binName, the shim goes over origPath.
+struct CompilerBinary {
+	fs::path origPath;
+	std::string binName;
+};
+
+struct CompilerName {
+	std::string name;
+	size_t binary;
+};
+
+struct MountPlan {
+	std::vector<CompilerBinary> binaries;
+	std::vector<CompilerName> names;
+};
+
+bool matchesCompiler(const char *name, const std::vector<std::string> &patterns) {
+	return isCompilerName(name) ||
+		std::any_of(patterns.begin(), patterns.end(), [name](const std::string &pattern) {
+			return fnmatch(pattern.c_str(), name, 0) == 0;
+		});
+}
+
+std::vector<PathMatch> scanPathDir(const std::string &dir, const std::vector<std::string> &patterns) {
+	std::vector<PathMatch> matches;
+
+	DIR *dirHandle = opendir(dir.c_str());
+	if (dirHandle == nullptr) {
+		return matches;
+	}
+
+	while (dirent *entry = readdir(dirHandle)) {
+		if (!matchesCompiler(entry->d_name, patterns)) {
+			continue;
 		}
+
+		std::string candidate = dir + "/" + entry->d_name;
+		char resolved[PATH_MAX];
+		struct stat st;
+		if (access(candidate.c_str(), X_OK) != 0 || realpath(candidate.c_str(), resolved) == nullptr ||
+		    stat(resolved, &st) != 0 || !S_ISREG(st.st_mode)) {
+			continue;
+		}
+
+		matches.push_back({entry->d_name, resolved, st.st_dev, st.st_ino});
 	}
 
-	return fs::canonical(newExePath);
+	closedir(dirHandle);
+
+	return matches;
 }
 
-std::ofstream nextLogFileHandle() {
-	static fs::path logDir;
-	if (logDir.empty()) {
-		char *env = getenv("CC_LOGDIR");
-		if (env == nullptr) {
-			std::cerr << "CC_LOGDIR not set" << std::endl;
-			exit(-1);
+// Scans all PATH directories in parallel, then merges the results in PATH
+// order: the first directory providing a name wins, like it would for a shell
+// lookup, and names resolving to the same inode share one binary.
+MountPlan discoverCompilers(const std::vector<std::string> &patterns) {
+	std::vector<std::string> pathDirs;
+	if (char *pathEnvVar = getenv("PATH")) {
+		std::stringstream ss(pathEnvVar);
+		std::string pathElem;
+		while (std::getline(ss, pathElem, ':')) {
+			if (!pathElem.empty() && std::find(pathDirs.begin(), pathDirs.end(), pathElem) == pathDirs.end()) {
+				pathDirs.push_back(pathElem);
+			}
 		}
-		logDir = fs::path{getenv("CC_LOGDIR")};
 	}
 
+	std::vector<std::vector<PathMatch>> found(pathDirs.size());
+	parallelFor(pathDirs.size(), [&](size_t i) {
+		found[i] = scanPathDir(pathDirs[i], patterns);
+	});
 
-	std::ofstream nextLogFileHandle;
-	fs::path lockFile = logDir / "ec.lock";
-	uint32_t highestProcessNumber = 0;
+	MountPlan plan;
+	std::set<std::string> names;
+	std::set<std::string> binNames;
+	std::map<std::pair<dev_t, ino_t>, size_t> binaries;
+	for (const std::vector<PathMatch> &matches : found) {
+		for (const PathMatch &match : matches) {
+			if (!names.insert(match.name).second) {
+				continue;
+			}
 
-	int fd = open(lockFile.string().c_str(), O_WRONLY | O_CREAT, 0600);
-	if (fd < 0) {
-		std::cerr << "could not open: " << lockFile << ": " << std::strerror(errno) << std::endl;
-		exit(-1);
+			auto [binary, inserted] = binaries.try_emplace({match.dev, match.ino}, plan.binaries.size());
+			if (inserted) {
+				std::string binName = match.origPath.filename().string();
+				for (int n = 2; !binNames.insert(binName).second; n++) {
+					binName = match.origPath.filename().string() + "." + std::to_string(n);
+				}
+				plan.binaries.push_back({match.origPath, binName});
+			}
+			plan.names.push_back({match.name, binary->second});
+		}
+	}
+
+	return plan;
+}
+
+// The wrappers get the plan through CC_COMPILERS (see capture.h) instead of
+// walking PATH themselves.
+std::string compilerTableEnv(const MountPlan &plan) {
+	std::string table;
+	for (const CompilerName &compiler : plan.names) {
+		const CompilerBinary &binary = plan.binaries[compiler.binary];
+		table += compiler.name + "\t" + binary.binName + "\t" + binary.origPath.string() + "\n";
 	}
 
-	if (flock(fd, LOCK_EX) != 0) {
-		std::cerr << "locking: " << lockFile << " failed: " << std::strerror(errno) << std::endl;
+	return table;
+}
+
+void bindMount(const fs::path &from, const fs::path &to) {
+	if (!fs::exists(to)) {
+		std::ofstream toFileHandle(to);
+		toFileHandle << "";
+	}
+	if (mount(from.string().c_str(), to.string().c_str(), "none", MS_BIND, NULL) < 0) {
+		std::cerr << "mounting " << from << " to " << to << " failed: " << strerror(errno);
 		exit(-1);
 	}
+}
 
-	for (const auto &entry : fs::directory_iterator(logDir)) {
-		if (entry.path().filename().string().rfind(execLogPrefix, 0)) {
-			continue;
-		}
-		std::string processNumberString = entry.path().filename().string().erase(0, execLogPrefix.size());
-		uint32_t processNumber = std::stoi(processNumberString);
-		if (processNumber > highestProcessNumber) {
-			highestProcessNumber = processNumber;
+// Shared by everything that ingests records; like the EntryStore, callers
+// ingest one record at a time.
+static ResponseFiles responseFiles;
+// --all-invocations: the wrappers kept every invocation, so does ingestion
+static bool keepAllInvocations = false;
+
+template<typename RecordType>
+void populateJson(const RecordType &record, EntryStore &entries) {
+	if (record.responseFiles.empty()) {
+		entries.add(record);
+		return;
+	}
+
+	// the wrapper could not see the sources behind the @files
+	RecordView expanded;
+	if (responseFiles.expand(record, expanded) == compiler_args::Invocation::Compile || keepAllInvocations) {
+		entries.add(expanded);
+	}
+}
+
+void populateJson(const char *records, const char *end, EntryStore &entries) {
+	RecordView record;
+	while (records < end) {
+		if (!decodeRecord(records, end, record)) {
+			std::cerr << "skipping malformed capture record" << std::endl;
+			return;
 		}
+
+		populateJson(record, entries);
 	}
+}
 
-	std::string logFilename = execLogPrefix + std::to_string(highestProcessNumber + 1);
-	nextLogFileHandle.open(logDir / logFilename);
-	if (close(fd) < 0) {
-		std::cerr << "closing: " << lockFile << " failed: " << std::strerror(errno) << std::endl;
-		exit(-1);
+// Appends file to buffer; false if it does not exist, e.g. a wrapper took a
+// number and died before writing its log
+bool readLogFile(const fs::path &file, std::vector<char> &buffer) {
+	int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat st;
+	size_t start = buffer.size();
+	buffer.resize(start + (fstat(fd, &st) == 0 ? st.st_size : 0));
+	size_t used = start;
+	ssize_t n;
+	while (true) {
+		if (used == buffer.size()) {
+			buffer.resize(used + 4096);
+		}
+		n = read(fd, buffer.data() + used, buffer.size() - used);
+		if (n <= 0) {
+			break;
+		}
+		used += n;
 	}
+	buffer.resize(used);
+	close(fd);
 
-	return nextLogFileHandle;
+	return true;
 }
 
-fs::path detectFileFromArgv(char **argv) {
-	static std::set<std::string> sourceExtensions = {".cpp", ".c", ".cxx", ".c++"};
-	for (int i = 1; argv[i] != nullptr; i++) {
-		if (argv[i][0] == '-') {
-			// let's hope nobody uses files that begin with '-'
-			continue;
+void decodeRecords(const char *records, const char *end, std::vector<RecordView> &decoded) {
+	while (records < end) {
+		decoded.emplace_back();
+		if (!decodeRecord(records, end, decoded.back())) {
+			decoded.pop_back();
+			std::cerr << "skipping malformed capture record" << std::endl;
+			return;
 		}
+	}
+}
 
-		if (fs::exists(argv[i]) && sourceExtensions.count(fs::path{argv[i]}.extension()) > 0) {
-			return fs::path{argv[i]};
+// Splits buf into slices of about sliceSize bytes that start and end on record
+// boundaries. Only the length prefixes are read, decoding is left to the
+// ingestion threads.
+std::vector<std::pair<const char*, const char*>> splitRecords(const char *records, const char *end, size_t sliceSize) {
+	std::vector<std::pair<const char*, const char*>> slices;
+	const char *sliceStart = records;
+	while (records < end) {
+		const char *p = records;
+		uint64_t length;
+		if (!getVarint(p, end, length) || length > static_cast<uint64_t>(end - p)) {
+			// let decodeRecords() complain about it
+			records = end;
+			break;
 		}
+		records = p + length;
+		if (static_cast<size_t>(records - sliceStart) >= sliceSize) {
+			slices.emplace_back(sliceStart, records);
+			sliceStart = records;
+		}
+	}
+	if (sliceStart < end) {
+		slices.emplace_back(sliceStart, end);
 	}
 
-	return fs::path{};
+	return slices;
 }
 
-void logExec(const fs::path &exe, char **argv) {
-	std::ofstream execLogFile = nextLogFileHandle();
+// Records of one chunk point either into the mapped append log, at mapped,
+// or into storage, which holds the numbered logs the chunk has read.
+struct IngestedChunk {
+	std::pair<const char*, const char*> mapped{nullptr, nullptr};
+	std::vector<char> storage;
+	std::vector<RecordView> records;
+};
 
-	char *currentDir = get_current_dir_name();
-
-	fs::path file = detectFileFromArgv(argv);
-	if (file.empty()) {
-		file = fs::path{currentDir};
+// Runs ingest(i, chunk) for every chunk 0..chunkCount-1 on a pool of threads
+// that pick the next chunk from a shared counter, and adds the decoded records
+// to entries in chunk order from the calling thread as soon as the next chunk
+// is complete. Threads stay at most a window of chunks ahead of that, so only
+// so many raw chunks are in memory at once; release() is called on the mapped
+// range of every chunk once it has been interned.
+void ingestInOrder(size_t chunkCount, const std::function<void(size_t, IngestedChunk&)> &ingest,
+                   const std::function<void(const char*, const char*)> &release, EntryStore &entries) {
+	if (chunkCount == 0) {
+		return;
 	}
 
-	execLogFile << "CWD: " << currentDir << '\n';
-	execLogFile << "FILE: " << file.string() << '\n';
-	execLogFile << "CMD: " << exe.string();
-	for (int i = 1; argv[i] != nullptr; i++) {
-		execLogFile << " " << argv[i];
-	}
+	size_t window = 4 * parallelism(chunkCount);
 
-	execLogFile << '\n';
+	std::vector<IngestedChunk> results(chunkCount);
+	std::vector<bool> done(chunkCount);
+	size_t written = 0;
+	std::mutex mutex;
+	std::condition_variable changed;
 
-	free(currentDir);
+	// the pool runs beside this thread, which adds the chunks in order
+	std::thread pool{[&]() {
+		parallelFor(chunkCount, [&](size_t i) {
+			{
+				std::unique_lock<std::mutex> lock{mutex};
+				changed.wait(lock, [&]() { return i < written + window; });
+			}
+
+			IngestedChunk chunk;
+			ingest(i, chunk);
+
+			std::lock_guard<std::mutex> lock{mutex};
+			results[i] = std::move(chunk);
+			done[i] = true;
+			changed.notify_all();
+		});
+	}};
+
+	while (written < chunkCount) {
+		IngestedChunk chunk;
+		{
+			std::unique_lock<std::mutex> lock{mutex};
+			changed.wait(lock, [&]() { return done[written]; });
+			chunk = std::move(results[written]);
+		}
+
+		for (const RecordView &record : chunk.records) {
+			populateJson(record, entries);
+		}
+		if (chunk.mapped.first != nullptr) {
+			release(chunk.mapped.first, chunk.mapped.second);
+		}
+
+		std::lock_guard<std::mutex> lock{mutex};
+		written++;
+		changed.notify_all();
+	}
+
+	pool.join();
 }
 
-int execCompiler(int argc, char **argv) {
-	fs::path ccBinDirPath = fs::path{getenv("CC_BINDIR")};
-	fs::path argvPath = fs::path{argv[0]};
-	fs::path pathToExec = ccBinDirPath / argvPath.filename();
+// Ingests what the wrappers left on disk after the build: the append log,
+// mapped and split into slices, and the numbered logs, in ranges of
+// logsPerChunk, in that order. Records are decoded into views and only
+// copied when entries interns them.
+void ingestLogs(const fs::path &logDir, const fs::path *appendLog, uint64_t count, EntryStore &entries) {
+	static constexpr uint64_t logsPerChunk = 256;
+	static constexpr size_t appendSliceSize = 1 << 20;
 
-	if (pathToExec.empty()) {
-		errno = ENOENT;
-		return -1;
+	std::unique_ptr<MappedFile> appended;
+	std::vector<std::pair<const char*, const char*>> slices;
+	if (appendLog != nullptr) {
+		appended = std::make_unique<MappedFile>(*appendLog);
+		slices = splitRecords(appended->data(), appended->data() + appended->size(), appendSliceSize);
 	}
-	logExec(getOriginalPath(pathToExec.filename()), argv);
 
-	// gcc has a weird bug if argv[0] == "./gcc"
-	argv[0] = strdup(pathToExec.filename().string().c_str());
-	execvp(pathToExec.string().c_str(), argv);
+	size_t rangeCount = (count + logsPerChunk - 1) / logsPerChunk;
+	ingestInOrder(slices.size() + rangeCount, [&](size_t index, IngestedChunk &chunk) {
+		if (index < slices.size()) {
+			chunk.mapped = slices[index];
+			decodeRecords(slices[index].first, slices[index].second, chunk.records);
+			return;
+		}
 
-	free(argv[0]);
+		// read everything first, views must not see storage move
+		uint64_t first = (index - slices.size()) * logsPerChunk + 1;
+		uint64_t last = std::min(count, first + logsPerChunk - 1);
+		std::vector<size_t> fileEnds;
+		for (uint64_t i = first; i <= last; i++) {
+			fs::path logfile = logDir / (std::string{execLogPrefix} + std::to_string(i));
+			if (readLogFile(logfile, chunk.storage)) {
+				fileEnds.push_back(chunk.storage.size());
+			}
+		}
 
-	return 0;
+		// per file, so a truncated log cannot take the following ones with it
+		size_t fileStart = 0;
+		for (size_t fileEnd : fileEnds) {
+			decodeRecords(chunk.storage.data() + fileStart, chunk.storage.data() + fileEnd, chunk.records);
+			fileStart = fileEnd;
+		}
+	}, [&](const char *begin, const char *end) {
+		appended->release(begin, end);
+	}, entries);
 }
 
-void bindMount(const fs::path &from, const fs::path &to) {
-	if (!fs::exists(to)) {
-		std::ofstream toFileHandle(to);
-		toFileHandle << "";
+int listenLogSocket(const fs::path &socketPath) {
+	sockaddr_un addr{};
+	addr.sun_family = AF_UNIX;
+	if (socketPath.string().size() >= sizeof(addr.sun_path)) {
+		std::cerr << "socket path too long: " << socketPath << std::endl;
+		exit(-1);
 	}
-	if (mount(from.string().c_str(), to.string().c_str(), "none", MS_BIND, NULL) < 0) {
-		std::cerr << "mounting " << from << " to " << to << " failed: " << strerror(errno);
+	strcpy(addr.sun_path, socketPath.string().c_str());
+
+	int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (fd < 0) {
+		std::cerr << "socket failed: " << strerror(errno) << std::endl;
 		exit(-1);
 	}
+
+	if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(fd, SOMAXCONN) < 0) {
+		std::cerr << "listening on " << socketPath << " failed: " << strerror(errno) << std::endl;
+		exit(-1);
+	}
+
+	return fd;
 }
 
-void populateJson(const fs::path &file, nlohmann::json &json) {
-	nlohmann::json elem;
-	std::ifstream logfileStream;
-	logfileStream.open(file);
+bool receiveLogRecord(int fd, EntryStore &entries, std::mutex &entriesMutex) {
+	ssize_t length = recv(fd, nullptr, 0, MSG_PEEK | MSG_TRUNC);
+	if (length <= 0) {
+		return false;
+	}
 
-	std::string line;
-	while (std::getline(logfileStream, line)) {
-		if (line.rfind("CWD: ", 0) == 0) {
-			elem["directory"] = line.substr(5);
-		} else if (line.rfind("CMD: ", 0) == 0) {
-			elem["command"] = line.substr(5);
-		} else if (line.rfind("FILE: ", 0) == 0) {
-			elem["file"] = line.substr(6);
+	std::string record(length, '\0');
+	if (recv(fd, record.data(), record.size(), 0) != length) {
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock{entriesMutex};
+	populateJson(record.data(), record.data() + record.size(), entries);
+
+	return true;
+}
+
+// Runs in the invocateBuild parent while the build is going on: accepts one
+// connection per wrapper and ingests its datagram right away. Returns the wait
+// status of the build once it has exited and all pending records are read.
+int collectLogRecords(int listenFd, pid_t pid, EntryStore &entries, std::mutex &entriesMutex) {
+	int epollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (epollFd < 0) {
+		std::cerr << "epoll_create1 failed: " << strerror(errno) << std::endl;
+		exit(-1);
+	}
+
+	epoll_event event{};
+	event.events = EPOLLIN;
+	event.data.fd = listenFd;
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event);
+
+	int pidFd = syscall(SYS_pidfd_open, pid, 0);
+	if (pidFd >= 0) {
+		event.data.fd = pidFd;
+		epoll_ctl(epollFd, EPOLL_CTL_ADD, pidFd, &event);
+	}
+
+	int status = -1;
+	bool exited = false;
+	epoll_event events[64];
+	while (true) {
+		// once the build is gone, only drain what is already queued
+		int timeout = exited ? 0 : (pidFd >= 0 ? -1 : 100);
+		int n = epoll_wait(epollFd, events, 64, timeout);
+		if (n < 0 && errno != EINTR) {
+			std::cerr << "epoll_wait failed: " << strerror(errno) << std::endl;
+			exit(-1);
+		}
+
+		for (int i = 0; i < n; i++) {
+			int fd = events[i].data.fd;
+			if (fd == listenFd) {
+				int connFd;
+				while ((connFd = accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK)) >= 0) {
+					event.data.fd = connFd;
+					epoll_ctl(epollFd, EPOLL_CTL_ADD, connFd, &event);
+				}
+			} else if (fd != pidFd) {
+				while (receiveLogRecord(fd, entries, entriesMutex)) {
+				}
+				if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+					close(fd);
+				}
+			}
+		}
+
+		if (exited && n <= 0) {
+			break;
+		}
+		if (!exited && waitpid(pid, &status, WNOHANG) == pid) {
+			exited = true;
+			if (pidFd >= 0) {
+				epoll_ctl(epollFd, EPOLL_CTL_DEL, pidFd, nullptr);
+			}
 		}
 	}
 
-	json.push_back(elem);
+	if (pidFd >= 0) {
+		close(pidFd);
+	}
+	close(epollFd);
+
+	return status;
 }
 
-int invocateBuild(char **argv) {
+// Consumer side of the ring, run on its own thread while the parent waits for
+// the build. Stops once the build is done and no committed record is left.
+void drainRecordRing(RecordRing &ring, const std::atomic<bool> &buildDone, EntryStore &entries, std::mutex &entriesMutex) {
+	std::string record;
+	size_t abandoned = 0;
+	while (true) {
+		bool done = buildDone.load();
+		if (ring.pop(record)) {
+			std::lock_guard<std::mutex> lock{entriesMutex};
+			populateJson(record.data(), record.data() + record.size(), entries);
+			continue;
+		}
+		if (done) {
+			// the build is over, a slot still uncommitted belongs to a killed wrapper
+			if (ring.skipAbandoned()) {
+				abandoned++;
+				continue;
+			}
+			break;
+		}
+		// invocateBuild notifies the ring once the build is over
+		ring.waitForRecord([&buildDone]() { return buildDone.load(); });
+	}
+
+	if (abandoned > 0) {
+		std::cerr << "warning: skipped " << abandoned << " records of compiler wrappers killed while recording" << std::endl;
+	}
+	if (ring.pending() > 0) {
+		std::cerr << "warning: " << ring.pending() << " bytes of records were left in the ring, some compiles are missing" << std::endl;
+	}
+}
+
+// compile_commands.json, or the shards or dictionary instead
+void writeDatabase(EntryStore &entries, const BuildOptions &options) {
+	if (options.shardDepth > 0) {
+		writeShards(shardDirName, entries, options.shardDepth, options.indent);
+	} else if (options.dictionary) {
+		writeDictionary(dictionaryName, entries, entries.all());
+		writeIndex("compile_commands.idx", entries, entries.all());
+	} else {
+		writeCompileCommands("compile_commands.json", entries, entries.all(), options.indent);
+	}
+}
+
+int invocateBuild(char **argv, const BuildOptions &options) {
 	int status = -1;
 	pid_t pid = -1;
 
+	keepAllInvocations = options.allInvocations;
+
+	// read before the build: a database we cannot merge into should not cost a build
+	EntryStore entries;
+	size_t loaded = 0;
+	if (options.merge) {
+		bool readable = options.shardDepth > 0 ? loadShards(shardDirName, entries) :
+			options.dictionary ? loadDictionary(dictionaryName, entries) :
+			loadCompileCommands("compile_commands.json", entries);
+		if (!readable) {
+			exit(-1);
+		}
+		loaded = entries.size();
+	}
+
 	TemporaryDir logDir("/tmp/cc-logdir-XXXXXX");
 	TemporaryDir binDir("/tmp/cc-bindir-XXXXXX");
 
+	fs::create_directory(logDir.path() / responseFileDirName);
+
+	fs::path seqFile = logDir.path() / execSeqFilename;
+	uint64_t *counter = mapSequenceCounter(seqFile.string().c_str(), true);
+	if (counter == nullptr) {
+		std::cerr << "creating sequence counter " << seqFile << " failed: " << strerror(errno) << std::endl;
+		exit(-1);
+	}
+	fs::path appendLog = logDir.path() / execAppendLogFilename;
+	if (options.transport != Transport::Files) {
+		std::ofstream{appendLog};
+	}
+	fs::path socketPath = logDir.path() / execSocketFilename;
+	int listenFd = -1;
+	if (options.transport == Transport::Socket) {
+		listenFd = listenLogSocket(socketPath);
+	}
+	std::unique_ptr<RecordRing> ring;
+	if (options.transport == Transport::Ring) {
+		ring = std::make_unique<RecordRing>(recordRingCapacity);
+		if (!ring->valid()) {
+			std::cerr << "creating record ring failed: " << strerror(errno) << std::endl;
+			exit(-1);
+		}
+	}
+
+	MountPlan plan;
+	fs::path preload;
+	if (options.interception == Interception::Mounts) {
+		plan = discoverCompilers(options.compilerPatterns);
+	} else if (options.interception == Interception::Preload) {
+		preload = preloadPath();
+	}
+
+	// the child hands its seccomp listener back through this pair
+	int listenerSockets[2] = {-1, -1};
+	if (options.interception == Interception::Seccomp &&
+	    socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, listenerSockets) < 0) {
+		std::cerr << "socketpair failed: " << strerror(errno) << std::endl;
+		exit(-1);
+	}
+
 	uid_t uid = getuid();
 	gid_t gid = getgid();
 	pid = fork();
-	if (pid == 0) {
+	if (pid == 0 && options.interception == Interception::Seccomp) {
+		close(listenerSockets[0]);
+		int listenerFd = installExecFilter();
+		if (listenerFd < 0) {
+			std::cerr << "installing seccomp filter failed: " << strerror(errno) << std::endl;
+			_exit(127);
+		}
+		if (!sendFd(listenerSockets[1], listenerFd)) {
+			std::cerr << "passing seccomp listener failed: " << strerror(errno) << std::endl;
+			_exit(127);
+		}
+		close(listenerFd);
+		close(listenerSockets[1]);
+	} else if (pid == 0 && options.interception == Interception::Preload) {
+		std::string ldPreload = preload.string();
+		if (char *inherited = getenv("LD_PRELOAD")) {
+			ldPreload += std::string{":"} + inherited;
+		}
+		setenv("LD_PRELOAD", ldPreload.c_str(), 1);
+
+		std::string patterns;
+		for (const std::string &pattern : options.compilerPatterns) {
+			patterns += (patterns.empty() ? "" : ",") + pattern;
+		}
+		setenv("CC_PRELOAD_PATTERNS", patterns.c_str(), 1);
+	} else if (pid == 0) {
 		unshare(CLONE_NEWNS|CLONE_NEWUSER|CLONE_NEWPID);
 		if (fork()) {
 			int status = -1;
@@ -235,59 +735,310 @@ int invocateBuild(char **argv) {
 		snprintf(mappingBuf, 512, "0 %d 1", gid);
 		write(uid_mapFd, mappingBuf, strlen(mappingBuf));
 		close(gid_mapFd);
-		for (const auto &compilerBin : compilerInvocations) {
-			fs::path origPath = getOriginalPath(compilerBin);
-			if (origPath.empty()) {
-				continue;
-			}
-			bindMount(origPath, binDir.path() / compilerBin);
+		for (const CompilerBinary &binary : plan.binaries) {
+			bindMount(binary.origPath, binDir.path() / binary.binName);
 		}
-		for (const auto &compilerBin : compilerInvocations) {
-			fs::path origPath = getOriginalPath(compilerBin);
-			if (origPath.empty()) {
-				continue;
-			}
-			bindMount(fs::canonical(fs::path{ownPath()}), origPath);
+		fs::path wrapperPath = shimPath();
+		for (const CompilerBinary &binary : plan.binaries) {
+			bindMount(wrapperPath, binary.origPath);
 		}
+		setenv("CC_BINDIR", binDir.string().c_str(), 1);
+		setenv("CC_COMPILERS", compilerTableEnv(plan).c_str(), 1);
+	}
+	if (pid == 0) {
 		logDir.disableCleanup();
 		binDir.disableCleanup();
 		setenv("CC_LOGDIR", logDir.string().c_str(), 1);
-		setenv("CC_BINDIR", binDir.string().c_str(), 1);
+		unsetenv("CC_RECORDED");
+		if (options.allInvocations) {
+			setenv("CC_ALL_INVOCATIONS", "1", 1);
+		}
+		if (options.noCompile) {
+			setenv("CC_NO_COMPILE", "1", 1);
+		}
+		if (options.transport != Transport::Files) {
+			setenv("CC_LOGFILE", appendLog.string().c_str(), 1);
+		}
+		if (options.transport == Transport::Socket) {
+			setenv("CC_SOCKET", socketPath.string().c_str(), 1);
+		}
+		if (ring) {
+			std::string ringEnv = std::to_string(ring->fd()) + ":" + std::to_string(ring->size());
+			setenv("CC_RING", ringEnv.c_str(), 1);
+		}
 		execvp(argv[0], argv);
+		std::cerr << "executing " << argv[0] << " failed: " << strerror(errno) << std::endl;
+		_exit(127);
 	} else if (pid < 0) {
 		std::cerr << "fork failed: " << strerror(errno) << std::endl;
 		exit(-1);
 	}
 
-	if (wait(&status) < 0) {
+	// guards entries while the ring consumer or the live publisher run next to
+	// the collector
+	std::mutex entriesMutex;
+	std::atomic<bool> buildDone{false};
+	std::thread ringConsumer;
+	if (ring) {
+		ringConsumer = std::thread{drainRecordRing, std::ref(*ring), std::cref(buildDone), std::ref(entries),
+			std::ref(entriesMutex)};
+	}
+	std::unique_ptr<LivePublisher> live;
+	if (options.liveInterval > 0) {
+		live = std::make_unique<LivePublisher>(entries, entriesMutex, std::chrono::seconds{options.liveInterval},
+			[&options, loaded](EntryStore &published) {
+				if (options.merge) {
+					mergeCaptured(published, loaded);
+				}
+				deduplicate(published, options.dedup);
+				writeDatabase(published, options);
+			});
+	}
+
+	if (options.interception == Interception::Seccomp) {
+		close(listenerSockets[1]);
+		int listenerFd = receiveFd(listenerSockets[0]);
+		close(listenerSockets[0]);
+		if (listenerFd < 0) {
+			waitpid(pid, &status, 0);
+			return status;
+		}
+		ExecSupervisor supervisor{listenerFd,
+			[&options](const char *name) { return matchesCompiler(name, options.compilerPatterns); },
+			[&entries, &entriesMutex](const Record &record) {
+				std::lock_guard<std::mutex> lock{entriesMutex};
+				populateJson(record, entries);
+			}, options.allInvocations, logDir.string()};
+		status = supervisor.run(pid);
+		close(listenerFd);
+	} else if (options.transport == Transport::Socket) {
+		status = collectLogRecords(listenFd, pid, entries, entriesMutex);
+		close(listenFd);
+	} else if (wait(&status) < 0) {
 		std::cerr << "wait failed: " << strerror(errno) << std::endl;
 		exit(-1);
 	}
 
-	int count = 1;
-	nlohmann::json json;
-	while (count < std::numeric_limits<int>::max()) {
-		fs::path logfile = logDir.path() / (execLogPrefix + std::to_string(count));
-		if (!fs::exists(logfile)) {
+	if (ring) {
+		buildDone = true;
+		ring->notify();
+		ringConsumer.join();
+	}
+	// the final write below must not race with a live one
+	if (live) {
+		live->stop();
+	}
+
+	uint64_t count = __atomic_load_n(counter, __ATOMIC_RELAXED);
+	munmap(counter, sizeof(uint64_t));
+
+	ingestLogs(logDir.path(), options.transport != Transport::Files ? &appendLog : nullptr, count, entries);
+
+	if (options.merge) {
+		mergeCaptured(entries, loaded);
+	}
+	deduplicate(entries, options.dedup);
+
+	writeDatabase(entries, options);
+	return status;
+}
+
+// ec query [--index=<path>] [--directory] <path>: prints the entries of a
+// source, or of all sources below a directory, from the index written next to
+// the database
+int query(int argc, char **argv) {
+	std::string indexPath = "compile_commands.idx";
+	bool directory = false;
+	int i = 0;
+	for (; i < argc && std::string{argv[i]}.rfind("--", 0) == 0; i++) {
+		std::string option{argv[i]};
+		if (option == "--") {
+			i++;
 			break;
+		} else if (option.rfind("--index=", 0) == 0) {
+			indexPath = option.substr(strlen("--index="));
+		} else if (option == "--directory") {
+			directory = true;
+		} else {
+			std::cerr << "unknown option: " << option << std::endl;
+			return 1;
 		}
+	}
+	if (i + 1 != argc) {
+		std::cerr << "usage: ec query [--index=<path>] [--directory] <path>" << std::endl;
+		return 1;
+	}
 
-		populateJson(logfile, json);
-		count++;
+	ec_index::IndexReader index;
+	if (!index.open(indexPath.c_str())) {
+		std::cerr << "reading " << indexPath << " failed" << std::endl;
+		return 1;
 	}
 
-	std::ofstream compileCommandsStream;
-	compileCommandsStream.open("compile_commands.json");
+	std::string path;
+	appendAbsolutePath(path, fs::current_path().string(), argv[i]);
+	ec_index::IndexReader::Range found = directory ? index.findDirectory(path) : index.findFile(path);
 
-	compileCommandsStream << json.dump(4) << std::endl;
-	return status;
+	CompileCommandsWriter json{STDOUT_FILENO, 4};
+	std::vector<std::string_view> arguments;
+	for (const ec_index::IndexEntry *entry = found.first; entry != found.second; entry++) {
+		arguments.clear();
+		for (size_t argument = 0; argument < index.argumentCount(*entry); argument++) {
+			arguments.push_back(index.argument(*entry, argument));
+		}
+		json.entry(index.directory(*entry), index.file(*entry), arguments);
+	}
+	json.finish();
+
+	// like grep: nothing found is a failure
+	return found.first == found.second ? 1 : 0;
+}
+
+// ec expand [--compact] [<dictionary> [<database>]]: writes the plain
+// compile_commands.json of a --dictionary database
+int expand(int argc, char **argv) {
+	int indent = 4;
+	std::vector<std::string> paths;
+	for (int i = 0; i < argc; i++) {
+		if (std::string{argv[i]} == "--compact") {
+			indent = 0;
+		} else {
+			paths.push_back(argv[i]);
+		}
+	}
+	if (paths.size() > 2) {
+		std::cerr << "usage: ec expand [--compact] [<dictionary> [<database>]]" << std::endl;
+		return 1;
+	}
+
+	fs::path dictionary = paths.size() > 0 ? paths[0] : dictionaryName;
+	fs::path database = paths.size() > 1 ? paths[1] : "compile_commands.json";
+	if (!fs::exists(dictionary)) {
+		std::cerr << "reading " << dictionary << " failed: " << strerror(ENOENT) << std::endl;
+		return 1;
+	}
+	EntryStore entries;
+	if (!loadDictionary(dictionary, entries)) {
+		return 1;
+	}
+	writeCompileCommands(database, entries, entries.all(), indent);
+	return 0;
+}
+
+void usage(const char *name) {
+	std::cerr << "usage: " << name << " query [--index=<path>] [--directory] <path>" << std::endl;
+	std::cerr << "       " << name << " expand [--compact] [<dictionary> [<database>]]" << std::endl;
+	std::cerr << "       " << name << " [--preload|--seccomp] [--merge] [--dedup=first|last|distinct] [--shards=<depth>] [--dictionary] [--live[=<seconds>]] [--all-invocations] [--no-compile] [--compact] [--transport=files|append|socket|ring] [--compilers=<pattern>,...] [--] <command> [args...]" << std::endl;
+}
+
+bool parseOption(const std::string &option, BuildOptions &options) {
+	if (option == "--preload") {
+		options.interception = Interception::Preload;
+	} else if (option == "--seccomp") {
+		options.interception = Interception::Seccomp;
+	} else if (option == "--merge") {
+		options.merge = true;
+	} else if (option == "--dedup=first") {
+		options.dedup = DedupPolicy::First;
+	} else if (option == "--dedup=last") {
+		options.dedup = DedupPolicy::Last;
+	} else if (option == "--dedup=distinct") {
+		options.dedup = DedupPolicy::Distinct;
+	} else if (option.rfind("--shards=", 0) == 0) {
+		char *end;
+		long depth = strtol(option.c_str() + strlen("--shards="), &end, 10);
+		if (*end != '\0' || depth <= 0 || depth > 64) {
+			return false;
+		}
+		options.shardDepth = depth;
+	} else if (option == "--live") {
+		options.liveInterval = 2;
+	} else if (option.rfind("--live=", 0) == 0) {
+		char *end;
+		long interval = strtol(option.c_str() + strlen("--live="), &end, 10);
+		if (*end != '\0' || interval <= 0 || interval > 3600) {
+			return false;
+		}
+		options.liveInterval = interval;
+	} else if (option == "--all-invocations") {
+		options.allInvocations = true;
+	} else if (option == "--no-compile") {
+		options.noCompile = true;
+	} else if (option == "--dictionary") {
+		options.dictionary = true;
+	} else if (option == "--compact") {
+		options.indent = 0;
+	} else if (option == "--transport=files") {
+		options.transport = Transport::Files;
+	} else if (option == "--transport=append") {
+		options.transport = Transport::Append;
+	} else if (option == "--transport=socket") {
+		options.transport = Transport::Socket;
+	} else if (option == "--transport=ring") {
+		options.transport = Transport::Ring;
+	} else if (option.rfind("--compilers=", 0) == 0) {
+		std::stringstream ss(option.substr(strlen("--compilers=")));
+		std::string pattern;
+		while (std::getline(ss, pattern, ',')) {
+			if (!pattern.empty()) {
+				options.compilerPatterns.push_back(pattern);
+			}
+		}
+	} else {
+		return false;
+	}
+
+	return true;
 }
 
 int main(int argc, char **argv) {
 	fs::path ownCmd = fs::path{argv[0]}.filename();
-	if (compilerInvocations.count(ownCmd.string()) > 0) {
+	if (isCompilerName(ownCmd.string()) || isTabledCompiler(ownCmd.string().c_str())) {
 		return execCompiler(argc, argv);
 	}
 
-	return invocateBuild(&argv[1]);
+	if (argc > 1 && std::string{argv[1]} == "query") {
+		return query(argc - 2, argv + 2);
+	}
+	if (argc > 1 && std::string{argv[1]} == "expand") {
+		return expand(argc - 2, argv + 2);
+	}
+
+	BuildOptions options;
+	int i = 1;
+	for (; i < argc && std::string{argv[i]}.rfind("--", 0) == 0; i++) {
+		if (std::string{argv[i]} == "--") {
+			i++;
+			break;
+		}
+		if (!parseOption(argv[i], options)) {
+			std::cerr << "unknown option: " << argv[i] << std::endl;
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (i >= argc) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (options.dictionary && options.shardDepth > 0) {
+		std::cerr << "--dictionary and --shards cannot be combined" << std::endl;
+		return 1;
+	}
+	// the supervisor can only watch an exec, not answer it in the compiler's place
+	if (options.noCompile && options.interception == Interception::Seccomp) {
+		std::cerr << "--no-compile needs the shim or --preload, not --seccomp" << std::endl;
+		return 1;
+	}
+
+	// the supervisor sees every exec itself, wrappers never write records
+	if (options.interception == Interception::Seccomp) {
+		options.transport = Transport::Files;
+	} else if (options.liveInterval > 0 && (options.transport == Transport::Files || options.transport == Transport::Append)) {
+		// files and the append log are only read after the build
+		options.transport = Transport::Socket;
+	}
+
+	return invocateBuild(&argv[i], options);
 }
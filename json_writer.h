@@ -0,0 +1,319 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+#pragma once
+
+namespace fs = std::filesystem;
+
+// Finds the next byte of a JSON string that needs escaping. Arguments are
+// mostly long runs of plain characters, so this checks 16 or 32 of them at
+// once and the writer copies everything in between with one memcpy.
+namespace json_escape {
+
+constexpr bool needsEscape(char c) {
+	return static_cast<unsigned char>(c) < 0x20 || c == '"' || c == '\\';
+}
+
+inline size_t scanScalar(const char *p, size_t n, size_t i) {
+	while (i < n && !needsEscape(p[i])) {
+		i++;
+	}
+	return i;
+}
+
+#ifdef __SSE2__
+inline size_t scanSse2(const char *p, size_t n) {
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i control = _mm_set1_epi8(0x1f);
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+		// max(v, 0x1f) == 0x1f is an unsigned v <= 0x1f
+		__m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+			_mm_cmpeq_epi8(_mm_max_epu8(v, control), control));
+		int mask = _mm_movemask_epi8(hit);
+		if (mask != 0) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+	return scanScalar(p, n, i);
+}
+
+__attribute__((target("avx2"))) inline size_t scanAvx2(const char *p, size_t n) {
+	const __m256i quote = _mm256_set1_epi8('"');
+	const __m256i backslash = _mm256_set1_epi8('\\');
+	const __m256i control = _mm256_set1_epi8(0x1f);
+	size_t i = 0;
+	for (; i + 32 <= n; i += 32) {
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+		__m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, backslash)),
+			_mm256_cmpeq_epi8(_mm256_max_epu8(v, control), control));
+		unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(hit));
+		if (mask != 0) {
+			return i + __builtin_ctz(mask);
+		}
+	}
+	return i + scanSse2(p + i, n - i);
+}
+#endif
+
+// number of leading bytes of p that go into the output unchanged
+inline size_t plainPrefix(const char *p, size_t n) {
+#ifdef __SSE2__
+	static const bool avx2 = __builtin_cpu_supports("avx2");
+	return avx2 ? scanAvx2(p, n) : scanSse2(p, n);
+#else
+	return scanScalar(p, n, 0);
+#endif
+}
+
+} // namespace json_escape
+
+// Buffered JSON output through a fixed buffer, with the escaping above. It
+// goes to <path>.tmp first and only replaces path on finish(), a failed or
+// interrupted ec never leaves half a file behind. Strings are written byte for
+// byte apart from the escapes, so arguments that are not valid UTF-8 come out
+// as they went in.
+class JsonOutput {
+public:
+	explicit JsonOutput(const fs::path &path) : path(path), tmpPath(path.string() + ".tmp") {
+		fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (fd < 0) {
+			std::cerr << "opening " << tmpPath << " failed: " << strerror(errno) << std::endl;
+			exit(-1);
+		}
+	}
+
+	// writes to fd, e.g. stdout, which stays open
+	explicit JsonOutput(int fd) : fd(fd) {
+	}
+
+	~JsonOutput() {
+		if (fd >= 0 && !tmpPath.empty()) {
+			close(fd);
+			unlink(tmpPath.c_str());
+		}
+	}
+
+	JsonOutput(const JsonOutput&) = delete;
+	JsonOutput &operator=(const JsonOutput&) = delete;
+
+	void string(std::string_view value) {
+		// worst case every byte becomes \u00XX
+		size_t worstCase = 6 * value.size() + 2;
+		if (worstCase > sizeof(buffer)) {
+			longString(value);
+			return;
+		}
+		if (sizeof(buffer) - used < worstCase) {
+			flush();
+		}
+
+		char *out = buffer + used;
+		*out++ = '"';
+		while (!value.empty()) {
+			size_t plain = json_escape::plainPrefix(value.data(), value.size());
+			memcpy(out, value.data(), plain);
+			out += plain;
+			if (plain == value.size()) {
+				break;
+			}
+			out = escape(value[plain], out);
+			value.remove_prefix(plain + 1);
+		}
+		*out++ = '"';
+		used = out - buffer;
+	}
+
+	void number(size_t value) {
+		char digits[24];
+		put(std::string_view{digits, static_cast<size_t>(snprintf(digits, sizeof(digits), "%zu", value))});
+	}
+
+	void put(char c) {
+		if (used == sizeof(buffer)) {
+			flush();
+		}
+		buffer[used++] = c;
+	}
+
+	void put(std::string_view s) {
+		while (!s.empty()) {
+			if (used == sizeof(buffer)) {
+				flush();
+			}
+			size_t n = std::min(s.size(), sizeof(buffer) - used);
+			memcpy(buffer + used, s.data(), n);
+			used += n;
+			s.remove_prefix(n);
+		}
+	}
+
+	void finish() {
+		flush();
+
+		if (tmpPath.empty()) {
+			fd = -1;
+			return;
+		}
+		if (close(fd) < 0 || rename(tmpPath.c_str(), path.c_str()) < 0) {
+			std::cerr << "writing " << path << " failed: " << strerror(errno) << std::endl;
+			exit(-1);
+		}
+		fd = -1;
+	}
+
+private:
+	void longString(std::string_view value) {
+		put('"');
+		while (!value.empty()) {
+			size_t plain = json_escape::plainPrefix(value.data(), value.size());
+			put(value.substr(0, plain));
+			if (plain == value.size()) {
+				break;
+			}
+			char escaped[6];
+			put(std::string_view{escaped, static_cast<size_t>(escape(value[plain], escaped) - escaped)});
+			value.remove_prefix(plain + 1);
+		}
+		put('"');
+	}
+
+	static char *escape(char c, char *out) {
+		static constexpr char hex[] = "0123456789abcdef";
+		*out++ = '\\';
+		switch (c) {
+		case '"': *out++ = '"'; break;
+		case '\\': *out++ = '\\'; break;
+		case '\b': *out++ = 'b'; break;
+		case '\f': *out++ = 'f'; break;
+		case '\n': *out++ = 'n'; break;
+		case '\r': *out++ = 'r'; break;
+		case '\t': *out++ = 't'; break;
+		default:
+			memcpy(out, "u00", 3);
+			out[3] = hex[c >> 4];
+			out[4] = hex[c & 0xf];
+			out += 5;
+		}
+		return out;
+	}
+
+	void flush() {
+		for (size_t written = 0; written < used;) {
+			ssize_t n = write(fd, buffer + written, used - written);
+			if (n < 0 && errno == EINTR) {
+				continue;
+			}
+			if (n <= 0) {
+				std::cerr << "writing " << tmpPath << " failed: " << strerror(errno) << std::endl;
+				exit(-1);
+			}
+			written += n;
+		}
+		used = 0;
+	}
+
+	fs::path path;
+	std::string tmpPath;
+	int fd = -1;
+	char buffer[1 << 16];
+	size_t used = 0;
+};
+
+// Writes compile_commands.json one entry at a time through a JsonOutput, so
+// memory stays flat no matter how big the build is. The output is the same
+// as nlohmann's dump(4) (or dump() without indentation) of the old DOM.
+class CompileCommandsWriter {
+public:
+	CompileCommandsWriter(const fs::path &path, int indent)
+		: output(path), indent(indent), newlines("\n" + std::string(3 * indent, ' ')) {
+		output.put('[');
+	}
+
+	// writes to fd, e.g. stdout, which stays open
+	CompileCommandsWriter(int fd, int indent)
+		: output(fd), indent(indent), newlines("\n" + std::string(3 * indent, ' ')) {
+		output.put('[');
+	}
+
+	CompileCommandsWriter(const CompileCommandsWriter&) = delete;
+	CompileCommandsWriter &operator=(const CompileCommandsWriter&) = delete;
+
+	// arguments[0] is the compiler
+	template<typename Args>
+	void entry(std::string_view directory, std::string_view file, const Args &arguments) {
+		output.put(entries++ == 0 ? "" : ",");
+		newline(1);
+		output.put('{');
+
+		newline(2);
+		key("arguments");
+		output.put('[');
+		bool first = true;
+		for (const auto &argument : arguments) {
+			output.put(first ? "" : ",");
+			first = false;
+			newline(3);
+			output.string(argument);
+		}
+		newline(2);
+		output.put("],");
+
+		newline(2);
+		key("directory");
+		output.string(directory);
+		output.put(',');
+
+		newline(2);
+		key("file");
+		output.string(file);
+
+		newline(1);
+		output.put('}');
+	}
+
+	size_t size() const {
+		return entries;
+	}
+
+	void finish() {
+		if (entries > 0) {
+			newline(0);
+		}
+		output.put("]\n");
+		output.finish();
+	}
+
+private:
+	void newline(int level) {
+		if (indent > 0) {
+			output.put(std::string_view{newlines}.substr(0, 1 + level * indent));
+		}
+	}
+
+	void key(std::string_view name) {
+		output.string(name);
+		output.put(indent > 0 ? ": " : ":");
+	}
+
+	JsonOutput output;
+	int indent;
+	// "\n" and the indentation of the deepest level
+	std::string newlines;
+	size_t entries = 0;
+};
@@ -0,0 +1,93 @@
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "entry_store.h"
+
+#pragma once
+
+// --live: while the build runs, a thread republishes the database every
+// interval, so clangd can start indexing long before the build is done.
+//
+// The collectors keep adding to the shared EntryStore under mutex. The
+// publisher only holds the lock while it copies the entries added since its
+// last round into a store of its own, and writes from that copy; a slow write
+// never stalls the build's records.
+class LivePublisher {
+public:
+	// writes the database from entries; may reorder or filter entries.all(),
+	// which is restored afterwards
+	using Publish = std::function<void(EntryStore &entries)>;
+
+	LivePublisher(const EntryStore &entries, std::mutex &mutex, std::chrono::milliseconds interval, Publish publish)
+		: shared(entries), mutex(mutex), interval(interval), publish(std::move(publish)) {
+		thread = std::thread{&LivePublisher::run, this};
+	}
+
+	LivePublisher(const LivePublisher&) = delete;
+	LivePublisher &operator=(const LivePublisher&) = delete;
+
+	~LivePublisher() {
+		stop();
+	}
+
+	// waits for a write in progress; the final database is the caller's job
+	void stop() {
+		{
+			std::lock_guard<std::mutex> lock{stopMutex};
+			stopping = true;
+		}
+		stopped.notify_all();
+		if (thread.joinable()) {
+			thread.join();
+		}
+	}
+
+private:
+	void run() {
+		std::unique_lock<std::mutex> lock{stopMutex};
+		// measured from the end of the last write, so publishing a big
+		// database cannot take all the time
+		while (!stopped.wait_for(lock, interval, [this]() { return stopping; })) {
+			lock.unlock();
+			if (copyNewEntries()) {
+				std::vector<Entry> captured = own.all();
+				publish(own);
+				own.assign(std::move(captured));
+			}
+			lock.lock();
+		}
+	}
+
+	// false if nothing arrived since the last round
+	bool copyNewEntries() {
+		std::lock_guard<std::mutex> lock{mutex};
+		const std::vector<Entry> &all = shared.all();
+		if (all.size() == copied) {
+			return false;
+		}
+		for (; copied < all.size(); copied++) {
+			shared.arguments(all[copied], arguments);
+			own.add(shared.directory(all[copied]), shared.file(all[copied]), arguments);
+		}
+		return true;
+	}
+
+	const EntryStore &shared;
+	std::mutex &mutex;
+	std::chrono::milliseconds interval;
+	Publish publish;
+
+	EntryStore own;
+	size_t copied = 0;
+	std::vector<std::string_view> arguments;
+
+	std::mutex stopMutex;
+	std::condition_variable stopped;
+	bool stopping = false;
+	std::thread thread;
+};
@@ -0,0 +1,200 @@
+#include <dlfcn.h>
+#include <fnmatch.h>
+#include <spawn.h>
+
+#include "capture.h"
+#include "compiler_names.h"
+
+// ec-preload.so is what `ec --preload` puts into LD_PRELOAD instead of
+// mounting ec-shim over the compilers. It hooks the exec and spawn functions,
+// records compiler invocations right in the process that starts them and
+// then lets the real compiler run, so there is no second exec and no need
+// for user namespaces.
+
+template<typename Function>
+static Function *nextSymbol(const char *name) {
+	return reinterpret_cast<Function*>(dlsym(RTLD_NEXT, name));
+}
+
+// CC_PRELOAD_PATTERNS carries the --compilers patterns, comma separated
+static bool matchesExtraPattern(const char *name) {
+	const char *patterns = getenv("CC_PRELOAD_PATTERNS");
+	if (patterns == nullptr) {
+		return false;
+	}
+
+	char pattern[PATH_MAX];
+	while (*patterns != '\0') {
+		const char *end = strchrnul(patterns, ',');
+		size_t length = end - patterns;
+		if (length > 0 && length < sizeof(pattern)) {
+			memcpy(pattern, patterns, length);
+			pattern[length] = '\0';
+			if (fnmatch(pattern, name, 0) == 0) {
+				return true;
+			}
+		}
+		patterns = *end == ',' ? end + 1 : end;
+	}
+
+	return false;
+}
+
+// searchPath is set for the exec*p and posix_spawnp variants, which look a
+// bare name up along PATH. Returns whether the invocation got recorded.
+static bool recordExec(const char *file, char *const argv[], bool searchPath) {
+	// CC_RECORDED: we run inside a recorded compile, see execCompiler()
+	if (file == nullptr || argv == nullptr || getenv("CC_LOGDIR") == nullptr || getenv("CC_RECORDED") != nullptr) {
+		return false;
+	}
+
+	const char *slash = strrchr(file, '/');
+	const char *name = slash == nullptr ? file : slash + 1;
+	if (!isCompilerName(name) && !matchesExtraPattern(name)) {
+		return false;
+	}
+
+	char exe[PATH_MAX];
+	bool resolved = (searchPath && slash == nullptr) ? resolveCompiler(name, exe) : realpath(file, exe) != nullptr;
+	if (!resolved) {
+		// exec is going to fail anyway
+		return false;
+	}
+
+	int savedErrno = errno;
+	bool recorded = logExec(exe, argv);
+	errno = savedErrno;
+	return recorded;
+}
+
+// ec --no-compile (CC_NO_COMPILE): whether the compiler's outputs got faked
+// and the exec or spawn can be skipped, see fakeCompile()
+static bool fakeExec(const char *file, char *const argv[]) {
+	if (file == nullptr || argv == nullptr || getenv("CC_NO_COMPILE") == nullptr) {
+		return false;
+	}
+
+	const char *slash = strrchr(file, '/');
+	const char *name = slash == nullptr ? file : slash + 1;
+	if (!isCompilerName(name) && !matchesExtraPattern(name)) {
+		return false;
+	}
+
+	int savedErrno = errno;
+	bool faked = fakeCompile(argv);
+	errno = savedErrno;
+	return faked;
+}
+
+// posix_spawn of a faked compile still hands out a child to wait for
+static int spawnFaked(pid_t *pid) {
+	pid_t child = fork();
+	if (child < 0) {
+		return errno;
+	}
+	if (child == 0) {
+		_exit(0);
+	}
+	if (pid != nullptr) {
+		*pid = child;
+	}
+	return 0;
+}
+
+// The environment for a compiler: envp plus CC_RECORDED once it got recorded,
+// so that a compiler it runs in turn (ccache running gcc, a cc script running
+// gcc) is not recorded a second time.
+class CompilerEnvironment {
+public:
+	CompilerEnvironment(char *const envp[], bool recorded) : envp(envp) {
+		if (!recorded || envp == nullptr) {
+			return;
+		}
+		size_t count = 0;
+		while (envp[count] != nullptr) {
+			count++;
+		}
+		marked = static_cast<char**>(malloc((count + 2) * sizeof(char*)));
+		if (marked != nullptr) {
+			memcpy(marked, envp, count * sizeof(char*));
+			marked[count] = const_cast<char*>("CC_RECORDED=1");
+			marked[count + 1] = nullptr;
+		}
+	}
+
+	~CompilerEnvironment() {
+		int savedErrno = errno;
+		free(marked);
+		errno = savedErrno;
+	}
+
+	CompilerEnvironment(const CompilerEnvironment&) = delete;
+	CompilerEnvironment &operator=(const CompilerEnvironment&) = delete;
+
+	char *const *get() const {
+		return marked != nullptr ? marked : envp;
+	}
+
+private:
+	char *const *envp;
+	char **marked = nullptr;
+};
+
+extern "C" int execve(const char *path, char *const argv[], char *const envp[]) {
+	static auto realExecve = nextSymbol<int(const char*, char *const[], char *const[])>("execve");
+	CompilerEnvironment environment{envp, recordExec(path, argv, false)};
+	if (fakeExec(path, argv)) {
+		_exit(0);
+	}
+	return realExecve(path, argv, environment.get());
+}
+
+// execv and execvp pass environ, the variants taking envp can pass the marked one
+extern "C" int execv(const char *path, char *const argv[]) {
+	static auto realExecve = nextSymbol<int(const char*, char *const[], char *const[])>("execve");
+	CompilerEnvironment environment{environ, recordExec(path, argv, false)};
+	if (fakeExec(path, argv)) {
+		_exit(0);
+	}
+	return realExecve(path, argv, environment.get());
+}
+
+extern "C" int execvp(const char *file, char *const argv[]) {
+	static auto realExecvpe = nextSymbol<int(const char*, char *const[], char *const[])>("execvpe");
+	CompilerEnvironment environment{environ, recordExec(file, argv, true)};
+	if (fakeExec(file, argv)) {
+		_exit(0);
+	}
+	return realExecvpe(file, argv, environment.get());
+}
+
+extern "C" int execvpe(const char *file, char *const argv[], char *const envp[]) {
+	static auto realExecvpe = nextSymbol<int(const char*, char *const[], char *const[])>("execvpe");
+	CompilerEnvironment environment{envp, recordExec(file, argv, true)};
+	if (fakeExec(file, argv)) {
+		_exit(0);
+	}
+	return realExecvpe(file, argv, environment.get());
+}
+
+extern "C" int posix_spawn(pid_t *pid, const char *path, const posix_spawn_file_actions_t *fileActions,
+                           const posix_spawnattr_t *attr, char *const argv[], char *const envp[]) {
+	static auto realPosixSpawn = nextSymbol<int(pid_t*, const char*, const posix_spawn_file_actions_t*,
+	                                            const posix_spawnattr_t*, char *const[], char *const[])>("posix_spawn");
+	CompilerEnvironment environment{envp, recordExec(path, argv, false)};
+	if (fakeExec(path, argv)) {
+		return spawnFaked(pid);
+	}
+	return realPosixSpawn(pid, path, fileActions, attr, argv, environment.get());
+}
+
+extern "C" int posix_spawnp(pid_t *pid, const char *file, const posix_spawn_file_actions_t *fileActions,
+                            const posix_spawnattr_t *attr, char *const argv[], char *const envp[]) {
+	static auto realPosixSpawnp = nextSymbol<int(pid_t*, const char*, const posix_spawn_file_actions_t*,
+	                                             const posix_spawnattr_t*, char *const[], char *const[])>("posix_spawnp");
+	CompilerEnvironment environment{envp, recordExec(file, argv, true)};
+	if (fakeExec(file, argv)) {
+		return spawnFaked(pid);
+	}
+	return realPosixSpawnp(pid, file, fileActions, attr, argv, environment.get());
+}
@@ -0,0 +1,258 @@
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#pragma once
+
+// Binary capture record written by the wrappers, one per compiler invocation.
+//
+//   record := varint(length of body) body
+//   body   := u8(version) varint(pid) varint(ppid) varint(timestamp in ns)
+//             string(cwd) string(exe) varint(argc) string(argv)...
+//             varint(number of sources) varint(index into argv)...
+//             varint(number of response files) (varint(index into argv) string(snapshot))...
+//   string := varint(length) bytes
+//
+// Records are self-delimiting, so the same bytes can be stored one per file,
+// back to back in the append log, or sent as a datagram. argv keeps its
+// element boundaries, arguments containing spaces survive the round trip.
+// The sources (see compiler_args.h) are positions in argv, one compile of
+// several sources is one record. For an @file argument the wrapper keeps a
+// snapshot of the file in CC_LOGDIR, build tools delete them right after the
+// compile; ec expands it when it ingests the record.
+static constexpr uint8_t recordVersion = 3;
+
+struct Record {
+	uint64_t pid = 0;
+	uint64_t ppid = 0;
+	uint64_t timestamp = 0;
+	std::string cwd;
+	std::string exe;
+	std::vector<std::string> argv;
+	std::vector<uint32_t> sources;
+	// argv index of an @file and its snapshot
+	std::vector<std::pair<uint32_t, std::string>> responseFiles;
+};
+
+inline bool getVarint(const char *&p, const char *end, uint64_t &value) {
+	value = 0;
+	for (int shift = 0; p < end && shift < 64; shift += 7) {
+		uint8_t byte = static_cast<uint8_t>(*p++);
+		value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+		if ((byte & 0x80) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Same record, but every string points into the buffer it was decoded from;
+// that buffer has to outlive the view.
+struct RecordView {
+	uint64_t pid = 0;
+	uint64_t ppid = 0;
+	uint64_t timestamp = 0;
+	std::string_view cwd;
+	std::string_view exe;
+	std::vector<std::string_view> argv;
+	std::vector<uint32_t> sources;
+	std::vector<std::pair<uint32_t, std::string_view>> responseFiles;
+};
+
+inline bool getString(const char *&p, const char *end, std::string &value) {
+	uint64_t length;
+	if (!getVarint(p, end, length) || length > static_cast<uint64_t>(end - p)) {
+		return false;
+	}
+	value.assign(p, length);
+	p += length;
+
+	return true;
+}
+
+inline bool getString(const char *&p, const char *end, std::string_view &value) {
+	uint64_t length;
+	if (!getVarint(p, end, length) || length > static_cast<uint64_t>(end - p)) {
+		return false;
+	}
+	value = std::string_view{p, length};
+	p += length;
+
+	return true;
+}
+
+struct ResponseFileSnapshot {
+	uint32_t argument;
+	const char *path;
+};
+
+// What a wrapper knows about one invocation. The encoder below works on these
+// C strings directly and writes into a caller supplied buffer, so the shim
+// can produce a record without touching the heap.
+struct RecordFields {
+	uint64_t pid;
+	uint64_t ppid;
+	uint64_t timestamp;
+	const char *cwd;
+	const char *exe;
+	char *const *argv;
+	const uint32_t *sources;
+	size_t sourceCount;
+	const ResponseFileSnapshot *responseFiles;
+	size_t responseFileCount;
+};
+
+inline size_t varintSize(uint64_t value) {
+	size_t size = 1;
+	while (value >= 0x80) {
+		value >>= 7;
+		size++;
+	}
+	return size;
+}
+
+inline char *writeVarint(char *out, uint64_t value) {
+	while (value >= 0x80) {
+		*out++ = static_cast<char>(value | 0x80);
+		value >>= 7;
+	}
+	*out++ = static_cast<char>(value);
+	return out;
+}
+
+inline size_t stringSize(const char *value) {
+	size_t length = strlen(value);
+	return varintSize(length) + length;
+}
+
+inline char *writeString(char *out, const char *value) {
+	size_t length = strlen(value);
+	out = writeVarint(out, length);
+	memcpy(out, value, length);
+	return out + length;
+}
+
+inline size_t recordBodySize(const RecordFields &fields) {
+	size_t size = 1 + varintSize(fields.pid) + varintSize(fields.ppid) + varintSize(fields.timestamp) +
+		stringSize(fields.cwd) + stringSize(fields.exe);
+
+	size_t argc = 0;
+	for (; fields.argv[argc] != nullptr; argc++) {
+		size += stringSize(fields.argv[argc]);
+	}
+
+	size += varintSize(argc) + varintSize(fields.sourceCount);
+	for (size_t i = 0; i < fields.sourceCount; i++) {
+		size += varintSize(fields.sources[i]);
+	}
+
+	size += varintSize(fields.responseFileCount);
+	for (size_t i = 0; i < fields.responseFileCount; i++) {
+		size += varintSize(fields.responseFiles[i].argument) + stringSize(fields.responseFiles[i].path);
+	}
+
+	return size;
+}
+
+inline size_t encodedRecordSize(const RecordFields &fields) {
+	size_t bodySize = recordBodySize(fields);
+	return varintSize(bodySize) + bodySize;
+}
+
+// out must hold encodedRecordSize(fields) bytes
+inline void encodeRecord(const RecordFields &fields, char *out) {
+	out = writeVarint(out, recordBodySize(fields));
+	*out++ = static_cast<char>(recordVersion);
+	out = writeVarint(out, fields.pid);
+	out = writeVarint(out, fields.ppid);
+	out = writeVarint(out, fields.timestamp);
+	out = writeString(out, fields.cwd);
+	out = writeString(out, fields.exe);
+
+	size_t argc = 0;
+	while (fields.argv[argc] != nullptr) {
+		argc++;
+	}
+	out = writeVarint(out, argc);
+	for (size_t i = 0; i < argc; i++) {
+		out = writeString(out, fields.argv[i]);
+	}
+
+	out = writeVarint(out, fields.sourceCount);
+	for (size_t i = 0; i < fields.sourceCount; i++) {
+		out = writeVarint(out, fields.sources[i]);
+	}
+
+	out = writeVarint(out, fields.responseFileCount);
+	for (size_t i = 0; i < fields.responseFileCount; i++) {
+		out = writeVarint(out, fields.responseFiles[i].argument);
+		out = writeString(out, fields.responseFiles[i].path);
+	}
+}
+
+// Decodes the record at p into a Record or a RecordView and advances p past
+// it. Returns false on truncated or malformed input, p is unspecified then.
+template<typename RecordType>
+bool decodeRecord(const char *&p, const char *end, RecordType &record) {
+	uint64_t length;
+	if (!getVarint(p, end, length) || length == 0 || length > static_cast<uint64_t>(end - p)) {
+		return false;
+	}
+
+	const char *bodyEnd = p + length;
+	if (static_cast<uint8_t>(*p++) != recordVersion) {
+		return false;
+	}
+
+	uint64_t argc;
+	if (!getVarint(p, bodyEnd, record.pid) ||
+	    !getVarint(p, bodyEnd, record.ppid) ||
+	    !getVarint(p, bodyEnd, record.timestamp) ||
+	    !getString(p, bodyEnd, record.cwd) ||
+	    !getString(p, bodyEnd, record.exe) ||
+	    !getVarint(p, bodyEnd, argc) ||
+	    argc > static_cast<uint64_t>(bodyEnd - p)) {
+		return false;
+	}
+
+	record.argv.resize(argc);
+	for (auto &arg : record.argv) {
+		if (!getString(p, bodyEnd, arg)) {
+			return false;
+		}
+	}
+
+	uint64_t sourceCount;
+	if (!getVarint(p, bodyEnd, sourceCount) || sourceCount > static_cast<uint64_t>(bodyEnd - p)) {
+		return false;
+	}
+	record.sources.resize(sourceCount);
+	for (uint32_t &source : record.sources) {
+		uint64_t index;
+		if (!getVarint(p, bodyEnd, index) || index == 0 || index >= argc) {
+			return false;
+		}
+		source = static_cast<uint32_t>(index);
+	}
+
+	uint64_t responseFileCount;
+	if (!getVarint(p, bodyEnd, responseFileCount) || responseFileCount > static_cast<uint64_t>(bodyEnd - p)) {
+		return false;
+	}
+	record.responseFiles.resize(responseFileCount);
+	for (auto &[argument, snapshot] : record.responseFiles) {
+		uint64_t index;
+		if (!getVarint(p, bodyEnd, index) || index == 0 || index >= argc || !getString(p, bodyEnd, snapshot)) {
+			return false;
+		}
+		argument = static_cast<uint32_t>(index);
+	}
+
+	p = bodyEnd;
+
+	return true;
+}
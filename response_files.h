@@ -0,0 +1,137 @@
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "compiler_args.h"
+#include "record.h"
+#include "util.h"
+
+#pragma once
+
+// Expands the @file arguments of captured records. The wrappers leave a
+// snapshot of every response file in CC_LOGDIR (see snapshotResponseFile);
+// ec reads each snapshot once, and tokenizes each distinct content once, no
+// matter how many compiles of the build pass the same file.
+
+// Splits a response file like GCC's buildargv() does: whitespace separates
+// arguments, single and double quotes group them, and a backslash escapes the
+// next character everywhere, inside either kind of quotes too.
+inline std::vector<std::string> tokenizeResponseFile(std::string_view content) {
+	std::vector<std::string> arguments;
+	std::string argument;
+	bool inArgument = false;
+	char quote = '\0';
+	for (size_t i = 0; i < content.size(); i++) {
+		char c = content[i];
+		if (c == '\\' && i + 1 < content.size()) {
+			argument += content[++i];
+			inArgument = true;
+		} else if (quote != '\0') {
+			if (c == quote) {
+				quote = '\0';
+			} else {
+				argument += c;
+			}
+		} else if (c == '\'' || c == '"') {
+			quote = c;
+			inArgument = true;
+		} else if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v') {
+			if (inArgument) {
+				arguments.push_back(std::move(argument));
+				argument.clear();
+				inArgument = false;
+			}
+		} else {
+			argument += c;
+			inArgument = true;
+		}
+	}
+	if (inArgument) {
+		arguments.push_back(std::move(argument));
+	}
+	return arguments;
+}
+
+class ResponseFiles {
+public:
+	using Arguments = std::vector<std::string>;
+
+	// Fills expanded with record, every snapshotted @file replaced by its
+	// arguments, and returns how the result classifies. Nested @files are read
+	// from the disk relative to the record's directory, if they still exist.
+	// The views point into record and into this cache.
+	template<typename RecordType>
+	compiler_args::Invocation expand(const RecordType &record, RecordView &expanded) {
+		expanded.pid = record.pid;
+		expanded.ppid = record.ppid;
+		expanded.timestamp = record.timestamp;
+		expanded.cwd = record.cwd;
+		expanded.exe = record.exe;
+		expanded.argv.clear();
+		expanded.responseFiles.clear();
+
+		size_t next = 0;
+		for (size_t i = 0; i < record.argv.size(); i++) {
+			if (next < record.responseFiles.size() && record.responseFiles[next].first == i) {
+				const Arguments *arguments = load(std::string{record.responseFiles[next].second});
+				next++;
+				if (arguments != nullptr) {
+					append(*arguments, record.cwd, 1, expanded.argv);
+					continue;
+				}
+			}
+			expanded.argv.push_back(record.argv[i]);
+		}
+
+		expanded.sources.clear();
+		compiler_args::forEachSource(expanded.argv, expanded.argv.size(), [&expanded](size_t i) {
+			expanded.sources.push_back(static_cast<uint32_t>(i));
+		});
+		return compiler_args::classify(expanded.argv, expanded.argv.size(), expanded.cwd);
+	}
+
+private:
+	// GCC gives up on deeper nesting as well
+	static constexpr int maxDepth = 16;
+
+	void append(const Arguments &arguments, std::string_view cwd, int depth, std::vector<std::string_view> &out) {
+		for (const std::string &argument : arguments) {
+			if (argument.size() > 1 && argument[0] == '@' && depth < maxDepth) {
+				std::string path = argument[1] == '/' ? argument.substr(1) : std::string{cwd} + "/" + argument.substr(1);
+				if (const Arguments *nested = load(path)) {
+					append(*nested, cwd, depth + 1, out);
+					continue;
+				}
+			}
+			out.push_back(argument);
+		}
+	}
+
+	// nullptr if path cannot be read
+	const Arguments *load(const std::string &path) {
+		auto cached = byPath.find(path);
+		if (cached != byPath.end()) {
+			return cached->second;
+		}
+
+		MappedFile file{path};
+		const Arguments *arguments = nullptr;
+		if (file.data() != nullptr || access(path.c_str(), R_OK) == 0) {
+			std::string content{file.data() == nullptr ? "" : std::string_view{file.data(), file.size()}};
+			auto tokenized = byContent.find(content);
+			if (tokenized == byContent.end()) {
+				Arguments split = tokenizeResponseFile(content);
+				tokenized = byContent.emplace(std::move(content), std::make_unique<Arguments>(std::move(split))).first;
+			}
+			arguments = tokenized->second.get();
+		}
+		byPath.emplace(path, arguments);
+		return arguments;
+	}
+
+	std::unordered_map<std::string, const Arguments*> byPath;
+	// keyed by the content itself, hashed by the map
+	std::unordered_map<std::string, std::unique_ptr<Arguments>> byContent;
+};
@@ -0,0 +1,259 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <string>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#pragma once
+
+// Multi-producer single-consumer ring for capture records. invocateBuild
+// creates it in a memfd that every wrapper of the build inherits; wrappers
+// reserve space with a CAS on the head, write the slot's length right away
+// and commit by setting its committed bit last, the parent drains it from a
+// consumer thread.
+//
+// Every slot is [uint64_t length << 1 | committed][payload] padded to 8
+// bytes, so a length word never straddles the end of the ring. The consumer
+// zeroes what it has read before handing the space back, which is how it
+// tells a committed slot from one that is only reserved. A wrapper killed
+// before its commit leaves a slot with a length but no committed bit; once
+// the build is over the consumer can step over it (see skipAbandoned).
+//
+// The consumer sleeps on a futex over a commit counter in the header while
+// the ring is empty; wrappers only pay for the wake syscall when it does.
+class RecordRing {
+public:
+	RecordRing(size_t capacity) {
+		capacity = align(capacity);
+		int fd = memfd_create("ec-ring", MFD_ALLOW_SEALING);
+		if (fd < 0) {
+			return;
+		}
+		// sealed, a wrapper that finds the size it expects can map it without
+		// risking SIGBUS
+		if (ftruncate(fd, sizeof(Header) + capacity) < 0 ||
+		    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+			close(fd);
+			return;
+		}
+		if (!map(fd, sizeof(Header) + capacity)) {
+			close(fd);
+			return;
+		}
+		ringFd = fd;
+		header->capacity = capacity;
+		header->magic = ringMagic;
+	}
+
+	// fd comes from CC_RING, and a build step may have closed it and opened
+	// something else under the same number
+	RecordRing(int fd, size_t size) {
+		struct stat st;
+		if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || static_cast<size_t>(st.st_size) != size ||
+		    size < sizeof(Header)) {
+			return;
+		}
+		int seals = fcntl(fd, F_GET_SEALS);
+		if (seals < 0 || (seals & (F_SEAL_SHRINK | F_SEAL_GROW)) != (F_SEAL_SHRINK | F_SEAL_GROW)) {
+			return;
+		}
+		if (map(fd, size) && (header->magic != ringMagic || sizeof(Header) + header->capacity != size)) {
+			munmap(header, size);
+			header = nullptr;
+		}
+	}
+
+	~RecordRing() {
+		if (header != nullptr) {
+			munmap(header, mappedSize);
+		}
+		if (ringFd >= 0) {
+			close(ringFd);
+		}
+	}
+
+	RecordRing(const RecordRing&) = delete;
+	RecordRing &operator=(const RecordRing&) = delete;
+
+	bool valid() const {
+		return header != nullptr;
+	}
+
+	int fd() const {
+		return ringFd;
+	}
+
+	size_t size() const {
+		return mappedSize;
+	}
+
+	// false means the ring is full and the caller has to spill the record
+	bool push(const char *record, size_t length) {
+		uint64_t need = align(sizeof(uint64_t) + length);
+		uint64_t head = head_().load(std::memory_order_relaxed);
+		do {
+			uint64_t tail = tail_().load(std::memory_order_acquire);
+			if (head + need - tail > header->capacity) {
+				return false;
+			}
+		} while (!head_().compare_exchange_weak(head, head + need, std::memory_order_relaxed));
+
+		lengthAt(head).store(length << 1, std::memory_order_relaxed);
+		copyIn(head + sizeof(uint64_t), record, length);
+		lengthAt(head).store(length << 1 | committed, std::memory_order_release);
+		notify();
+
+		return true;
+	}
+
+	// Wakes the consumer if it sleeps in wait(); the parent calls it once the
+	// build is over, too.
+	void notify() {
+		commits_().fetch_add(1);
+		if (sleeping_().load()) {
+			futex(FUTEX_WAKE, 1, nullptr);
+		}
+	}
+
+	// Consumer side: sleeps until a record is committed, stop() holds or a
+	// second passed. Both are checked after the commit counter is read, so a
+	// notify() racing with them makes the futex return at once.
+	template<typename Stop>
+	void waitForRecord(Stop stop) {
+		sleeping_().store(1);
+		uint32_t seen = commits_().load();
+		uint64_t tail = tail_().load(std::memory_order_relaxed);
+		if ((lengthAt(tail).load(std::memory_order_acquire) & committed) == 0 && !stop()) {
+			timespec timeout{1, 0};
+			futex(FUTEX_WAIT, seen, &timeout);
+		}
+		sleeping_().store(0);
+	}
+
+	// false means there is no committed record at the tail right now
+	bool pop(std::string &record) {
+		uint64_t tail = tail_().load(std::memory_order_relaxed);
+		uint64_t word = lengthAt(tail).load(std::memory_order_acquire);
+		if ((word & committed) == 0) {
+			return false;
+		}
+
+		uint64_t length = word >> 1;
+		uint64_t need = align(sizeof(uint64_t) + length);
+		record.resize(length);
+		copyOut(tail + sizeof(uint64_t), record.data(), length);
+		clear(tail, need);
+		tail_().store(tail + need, std::memory_order_release);
+
+		return true;
+	}
+
+	// Drops the slot at the tail if it is reserved but was never committed;
+	// only safe once no wrapper can still be writing it. false if there is no
+	// such slot, or if its writer did not even get to the length.
+	bool skipAbandoned() {
+		uint64_t tail = tail_().load(std::memory_order_relaxed);
+		uint64_t word = lengthAt(tail).load(std::memory_order_acquire);
+		if (word == 0 || (word & committed) != 0) {
+			return false;
+		}
+
+		uint64_t need = align(sizeof(uint64_t) + (word >> 1));
+		clear(tail, need);
+		tail_().store(tail + need, std::memory_order_release);
+
+		return true;
+	}
+
+	// bytes reserved but not consumed yet
+	uint64_t pending() {
+		return head_().load(std::memory_order_acquire) - tail_().load(std::memory_order_relaxed);
+	}
+
+private:
+	static constexpr uint64_t ringMagic = 0x33474e4952434500; // "\0ECRING3"
+	static constexpr uint64_t committed = 1;
+
+	struct Header {
+		uint64_t magic;
+		uint64_t capacity;
+		alignas(64) uint64_t head;
+		alignas(64) uint64_t tail;
+		alignas(64) uint32_t commits;
+		uint32_t sleeping;
+	};
+
+	static uint64_t align(uint64_t n) {
+		return (n + 7) & ~uint64_t{7};
+	}
+
+	bool map(int fd, size_t size) {
+		void *mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (mapping == MAP_FAILED) {
+			return false;
+		}
+		header = static_cast<Header*>(mapping);
+		data = reinterpret_cast<char*>(header + 1);
+		mappedSize = size;
+		return true;
+	}
+
+	std::atomic<uint64_t> &head_() {
+		return *reinterpret_cast<std::atomic<uint64_t>*>(&header->head);
+	}
+
+	std::atomic<uint64_t> &tail_() {
+		return *reinterpret_cast<std::atomic<uint64_t>*>(&header->tail);
+	}
+
+	std::atomic<uint32_t> &commits_() {
+		return *reinterpret_cast<std::atomic<uint32_t>*>(&header->commits);
+	}
+
+	std::atomic<uint32_t> &sleeping_() {
+		return *reinterpret_cast<std::atomic<uint32_t>*>(&header->sleeping);
+	}
+
+	// not FUTEX_PRIVATE: the wrappers share the word through the memfd
+	void futex(int operation, uint32_t value, const timespec *timeout) {
+		syscall(SYS_futex, &header->commits, operation, value, timeout, nullptr, 0);
+	}
+
+	std::atomic<uint64_t> &lengthAt(uint64_t position) {
+		return *reinterpret_cast<std::atomic<uint64_t>*>(data + position % header->capacity);
+	}
+
+	void copyIn(uint64_t position, const char *from, size_t length) {
+		size_t offset = position % header->capacity;
+		size_t first = std::min<size_t>(length, header->capacity - offset);
+		memcpy(data + offset, from, first);
+		memcpy(data, from + first, length - first);
+	}
+
+	void copyOut(uint64_t position, char *to, size_t length) {
+		size_t offset = position % header->capacity;
+		size_t first = std::min<size_t>(length, header->capacity - offset);
+		memcpy(to, data + offset, first);
+		memcpy(to + first, data, length - first);
+	}
+
+	void clear(uint64_t position, size_t length) {
+		size_t offset = position % header->capacity;
+		size_t first = std::min<size_t>(length, header->capacity - offset);
+		memset(data + offset, 0, first);
+		memset(data, 0, length - first);
+	}
+
+	Header *header = nullptr;
+	char *data = nullptr;
+	size_t mappedSize = 0;
+	int ringFd = -1;
+};
@@ -0,0 +1,379 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <sys/ioctl.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/audit.h>
+#include <linux/filter.h>
+#include <linux/limits.h>
+#include <linux/seccomp.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "capture.h"
+#include "record.h"
+
+#pragma once
+
+// Third way of catching compilers, next to the mounts and the preload library:
+// the build runs under a seccomp filter that turns every execve/execveat into
+// a user notification. The parent reads path, argv and cwd of the caller
+// from /proc/<pid>, records compilers and lets the exec continue. Nothing is
+// replaced on disk, so static binaries and absolute compiler paths are caught
+// as well; the price is one round trip to the parent per exec.
+
+#if defined(__x86_64__)
+#define EC_AUDIT_ARCH AUDIT_ARCH_X86_64
+#elif defined(__aarch64__)
+#define EC_AUDIT_ARCH AUDIT_ARCH_AARCH64
+#endif
+
+// Called in the child before it execs the build. Returns the listener fd or
+// -1 with errno set.
+inline int installExecFilter() {
+#ifdef EC_AUDIT_ARCH
+	sock_filter filter[] = {
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(seccomp_data, arch)),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, EC_AUDIT_ARCH, 1, 0),
+		BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(seccomp_data, nr)),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, __NR_execve, 1, 0),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, __NR_execveat, 0, 1),
+		BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_USER_NOTIF),
+		BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW),
+	};
+	sock_fprog program{static_cast<unsigned short>(sizeof(filter) / sizeof(filter[0])), filter};
+
+	if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) < 0) {
+		return -1;
+	}
+
+	return syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER, SECCOMP_FILTER_FLAG_NEW_LISTENER, &program);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+inline bool sendFd(int socket, int fd) {
+	char data = 0;
+	iovec iov{&data, 1};
+	alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+	msghdr message{};
+	message.msg_iov = &iov;
+	message.msg_iovlen = 1;
+	message.msg_control = control;
+	message.msg_controllen = sizeof(control);
+
+	cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	return sendmsg(socket, &message, 0) == 1;
+}
+
+inline int receiveFd(int socket) {
+	char data;
+	iovec iov{&data, 1};
+	alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+	msghdr message{};
+	message.msg_iov = &iov;
+	message.msg_iovlen = 1;
+	message.msg_control = control;
+	message.msg_controllen = sizeof(control);
+
+	if (recvmsg(socket, &message, 0) != 1) {
+		return -1;
+	}
+
+	cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+	if (cmsg == nullptr || cmsg->cmsg_type != SCM_RIGHTS) {
+		return -1;
+	}
+
+	int fd;
+	memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+	return fd;
+}
+
+class ExecSupervisor {
+public:
+	using Filter = std::function<bool(const char *name)>;
+	using Sink = std::function<void(const Record &record)>;
+
+	// allInvocations records every compiler exec, not only compiles of a
+	// translation unit (see compiler_args::classify); response files are
+	// snapshotted into logDir like the wrappers do
+	ExecSupervisor(int listenerFd, Filter isCompiler, Sink onCompiler, bool allInvocations, std::string logDir)
+		: listenerFd(listenerFd), isCompiler(std::move(isCompiler)), onCompiler(std::move(onCompiler)),
+		  allInvocations(allInvocations), logDir(std::move(logDir)) {
+		seccomp_notif_sizes sizes{};
+		if (syscall(SYS_seccomp, SECCOMP_GET_NOTIF_SIZES, 0, &sizes) < 0) {
+			sizes.seccomp_notif = sizeof(seccomp_notif);
+			sizes.seccomp_notif_resp = sizeof(seccomp_notif_resp);
+		}
+		requestSize = std::max<size_t>(sizes.seccomp_notif, sizeof(seccomp_notif));
+		responseSize = std::max<size_t>(sizes.seccomp_notif_resp, sizeof(seccomp_notif_resp));
+	}
+
+	// Serves notifications until pid has exited, returns its wait status.
+	// Processes that outlive it fail their execs once ec is gone.
+	int run(pid_t pid) {
+		int pidFd = syscall(SYS_pidfd_open, pid, 0);
+
+		int status = -1;
+		bool exited = false;
+		while (true) {
+			pollfd fds[2] = {{listenerFd, POLLIN, 0}, {pidFd, POLLIN, 0}};
+			int n = poll(fds, pidFd >= 0 ? 2 : 1, exited ? 0 : (pidFd >= 0 ? -1 : 100));
+			if (n < 0 && errno != EINTR) {
+				break;
+			}
+
+			if (fds[0].revents & POLLIN) {
+				handleNotification();
+			} else if (exited) {
+				break;
+			}
+
+			if (!exited && waitpid(pid, &status, WNOHANG) == pid) {
+				exited = true;
+			}
+		}
+
+		if (pidFd >= 0) {
+			close(pidFd);
+		}
+
+		return status;
+	}
+
+private:
+	void handleNotification() {
+		std::unique_ptr<char[]> requestBuffer{new char[requestSize]()};
+		std::unique_ptr<char[]> responseBuffer{new char[responseSize]()};
+		seccomp_notif *request = reinterpret_cast<seccomp_notif*>(requestBuffer.get());
+		seccomp_notif_resp *response = reinterpret_cast<seccomp_notif_resp*>(responseBuffer.get());
+
+		if (ioctl(listenerFd, SECCOMP_IOCTL_NOTIF_RECV, request) < 0) {
+			return;
+		}
+
+		Record record;
+		bool compiler = readExec(*request, record);
+
+		response->id = request->id;
+		response->flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+		ioctl(listenerFd, SECCOMP_IOCTL_NOTIF_SEND, response);
+
+		if (compiler) {
+			onCompiler(record);
+		}
+	}
+
+	bool readExec(const seccomp_notif &request, Record &record) {
+		bool execveat = request.data.nr == __NR_execveat;
+		int dirFd = execveat ? static_cast<int>(request.data.args[0]) : AT_FDCWD;
+		uint64_t pathAddress = request.data.args[execveat ? 1 : 0];
+		uint64_t argvAddress = request.data.args[execveat ? 2 : 1];
+
+		std::string procDir = "/proc/" + std::to_string(request.pid);
+		int memFd = open((procDir + "/mem").c_str(), O_RDONLY | O_CLOEXEC);
+		if (memFd < 0) {
+			return false;
+		}
+
+		std::string path;
+		bool complete = readString(memFd, pathAddress, path, PATH_MAX);
+		std::string name = path.substr(path.rfind('/') + 1);
+		if (!complete || !isCompiler(name.c_str())) {
+			close(memFd);
+			return false;
+		}
+
+		for (uint64_t address = argvAddress;; address += sizeof(uint64_t)) {
+			uint64_t argAddress;
+			if (pread(memFd, &argAddress, sizeof(argAddress), address) != sizeof(argAddress)) {
+				close(memFd);
+				return false;
+			}
+			if (argAddress == 0) {
+				break;
+			}
+			record.argv.emplace_back();
+			if (!readString(memFd, argAddress, record.argv.back(), 128 * 1024)) {
+				close(memFd);
+				return false;
+			}
+		}
+		close(memFd);
+
+		// the memory we read could belong to a recycled pid by now
+		if (ioctl(listenerFd, SECCOMP_IOCTL_NOTIF_ID_VALID, &request.id) < 0) {
+			return false;
+		}
+
+		record.cwd = readLink(procDir + "/cwd");
+		std::string base = dirFd == AT_FDCWD ? record.cwd : readLink(procDir + "/fd/" + std::to_string(dirFd));
+		std::string exe = path.empty() || path[0] == '/' ? path : base + "/" + path;
+		if (path.empty()) {
+			exe = base;
+		}
+
+		// execvp tries every PATH entry, only the one that exists is the real exec
+		char resolved[PATH_MAX];
+		if (record.cwd.empty() || access(exe.c_str(), X_OK) != 0 || realpath(exe.c_str(), resolved) == nullptr) {
+			return false;
+		}
+
+		compiler_args::Invocation invocation = compiler_args::classify(record.argv, record.argv.size(), record.cwd);
+		if (!allInvocations && invocation != compiler_args::Invocation::Compile &&
+		    invocation != compiler_args::Invocation::ResponseFile) {
+			return false;
+		}
+
+		// There is no environment to mark a recorded compile with, so the
+		// supervisor remembers the processes it recorded: a compiler exec'd by
+		// one of them (ccache running gcc) or in its place (a cc script doing
+		// exec gcc) is part of the same compile. The start time tells a reused
+		// pid from the recorded process.
+		uint64_t ppid = 0;
+		uint64_t startTime = 0;
+		uint64_t parentStartTime = 0;
+		uint64_t grandParent;
+		readStat(procDir, ppid, startTime);
+		readStat("/proc/" + std::to_string(ppid), grandParent, parentStartTime);
+		if (!allInvocations && (recorded.count({request.pid, startTime}) > 0 || recorded.count({ppid, parentStartTime}) > 0)) {
+			return false;
+		}
+
+		record.responseFiles.clear();
+		int cwdFd = -1;
+		for (size_t i = 1; i < record.argv.size(); i++) {
+			char snapshot[PATH_MAX];
+			if (record.argv[i].size() < 2 || record.argv[i][0] != '@') {
+				continue;
+			}
+			if (cwdFd < 0) {
+				cwdFd = open(record.cwd.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+			}
+			if (snapshotResponseFile(cwdFd, record.argv[i].c_str() + 1, logDir.c_str(), snapshot)) {
+				record.responseFiles.emplace_back(static_cast<uint32_t>(i), snapshot);
+			}
+		}
+		if (cwdFd >= 0) {
+			close(cwdFd);
+		}
+		// nothing to expand, see logExec()
+		if (!allInvocations && invocation == compiler_args::Invocation::ResponseFile && record.responseFiles.empty()) {
+			return false;
+		}
+		recorded.insert({request.pid, startTime});
+
+		record.sources.clear();
+		compiler_args::forEachSource(record.argv, record.argv.size(), [&record](size_t i) {
+			record.sources.push_back(static_cast<uint32_t>(i));
+		});
+
+		timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+
+		record.pid = request.pid;
+		record.ppid = ppid;
+		record.timestamp = static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+		record.exe = resolved;
+
+		return true;
+	}
+
+	static bool readString(int memFd, uint64_t address, std::string &value, size_t limit) {
+		char chunk[256];
+		value.clear();
+		while (value.size() < limit) {
+			ssize_t n = pread(memFd, chunk, sizeof(chunk), address + value.size());
+			if (n <= 0) {
+				// the string may end right before an unmapped page
+				n = pread(memFd, chunk, 1, address + value.size());
+				if (n <= 0) {
+					return false;
+				}
+			}
+			const char *end = static_cast<const char*>(memchr(chunk, '\0', n));
+			if (end != nullptr) {
+				value.append(chunk, end - chunk);
+				return true;
+			}
+			value.append(chunk, n);
+		}
+
+		return false;
+	}
+
+	static std::string readLink(const std::string &path) {
+		char buf[PATH_MAX];
+		ssize_t length = readlink(path.c_str(), buf, sizeof(buf));
+		return length < 0 ? std::string{} : std::string{buf, static_cast<size_t>(length)};
+	}
+
+	// parent pid and start time (in clock ticks since boot) of a process
+	static bool readStat(const std::string &procDir, uint64_t &ppid, uint64_t &startTime) {
+		ppid = 0;
+		startTime = 0;
+		int fd = open((procDir + "/stat").c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			return false;
+		}
+		char buf[1024];
+		ssize_t length = read(fd, buf, sizeof(buf) - 1);
+		close(fd);
+		if (length <= 0) {
+			return false;
+		}
+		buf[length] = '\0';
+
+		// "pid (comm) state ppid ...", comm may contain anything; starttime is
+		// the 20th field after comm
+		const char *field = strrchr(buf, ')');
+		if (field == nullptr) {
+			return false;
+		}
+		field += 2;
+		for (int i = 0; i < 19 && field != nullptr; i++) {
+			field = strchr(field, ' ');
+			field = field == nullptr ? nullptr : field + 1;
+			if (i == 0 && field != nullptr) {
+				ppid = strtoull(field, nullptr, 10);
+			}
+		}
+		if (field == nullptr) {
+			return false;
+		}
+		startTime = strtoull(field, nullptr, 10);
+		return true;
+	}
+
+	int listenerFd;
+	Filter isCompiler;
+	Sink onCompiler;
+	bool allInvocations;
+	std::string logDir;
+	// pid and start time of every recorded process
+	std::set<std::pair<uint64_t, uint64_t>> recorded;
+	size_t requestSize;
+	size_t responseSize;
+};
@@ -0,0 +1,144 @@
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+
+#include "nlohmann/json.hpp"
+#include "database.h"
+#include "entry_store.h"
+#include "json_writer.h"
+#include "util.h"
+
+#pragma once
+
+namespace fs = std::filesystem;
+
+// Instead of one compile_commands.json, --shards=<depth> writes one database
+// per directory prefix of the sources into compile_commands.d/:
+//
+//   compile_commands.d/manifest.json
+//   compile_commands.d/compile_commands.json          sources right in root
+//   compile_commands.d/src/lib/compile_commands.json  sources under src/lib
+//   compile_commands.d/external.json                  sources outside root
+//
+// A prefix has at most depth components of the source directory relative to
+// root; sources outside root share the prefix "..". The manifest lists every
+// shard with its prefix and entry count, so a tool can load just the ones it
+// needs.
+static constexpr const char *shardDirName = "compile_commands.d";
+static constexpr const char *shardManifestName = "manifest.json";
+static constexpr const char *externalShard = "..";
+
+// shard prefix of entry, externalShard for sources outside root
+inline std::string shardOf(const EntryStore &entries, const Entry &entry, const std::string &root, int depth) {
+	std::string source;
+	appendAbsolutePath(source, entries.directory(entry), entries.file(entry));
+
+	if (source.compare(0, root.size(), root) != 0 || (source.size() > root.size() && source[root.size()] != '/' && root != "/")) {
+		return externalShard;
+	}
+
+	std::string prefix;
+	size_t start = root == "/" ? 1 : root.size() + 1;
+	for (int level = 0; level < depth; level++) {
+		size_t slash = source.find('/', start);
+		// the last component is the file itself
+		if (slash == std::string::npos) {
+			break;
+		}
+		prefix += (prefix.empty() ? "" : "/") + source.substr(start, slash - start);
+		start = slash + 1;
+	}
+
+	return prefix.empty() ? "." : prefix;
+}
+
+inline fs::path shardFile(const std::string &prefix) {
+	if (prefix == externalShard) {
+		return "external.json";
+	}
+	if (prefix == ".") {
+		return "compile_commands.json";
+	}
+	return fs::path{prefix} / "compile_commands.json";
+}
+
+// Loads every shard listed in dir/manifest.json into entries; a missing
+// manifest is an empty database.
+inline bool loadShards(const fs::path &dir, EntryStore &entries) {
+	std::ifstream manifestStream{dir / shardManifestName};
+	if (!manifestStream) {
+		return true;
+	}
+
+	nlohmann::json manifest = nlohmann::json::parse(manifestStream, nullptr, false);
+	if (manifest.is_discarded() || !manifest.is_object() || !manifest["shards"].is_array()) {
+		std::cerr << "reading " << dir / shardManifestName << " failed" << std::endl;
+		return false;
+	}
+
+	for (const nlohmann::json &shard : manifest["shards"]) {
+		if (!shard.is_object() || !shard["file"].is_string() ||
+		    !loadCompileCommands(dir / shard["file"].get<std::string>(), entries)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Groups the entries by shard, writes the shards on a pool of threads into a
+// fresh directory and swaps it with dir in one rename, so readers see either
+// the old or the new set of shards, never a mix.
+inline void writeShards(const fs::path &dir, const EntryStore &entries, int depth, int indent) {
+	std::string root = fs::current_path().string();
+	std::map<std::string, std::vector<Entry>> shards;
+	for (const Entry &entry : entries.all()) {
+		shards[shardOf(entries, entry, root, depth)].push_back(entry);
+	}
+
+	fs::path tmpDir = dir.string() + ".tmp";
+	fs::remove_all(tmpDir);
+	fs::create_directories(tmpDir);
+
+	std::vector<std::pair<const std::string, std::vector<Entry>>*> work;
+	for (auto &shard : shards) {
+		work.push_back(&shard);
+		fs::create_directories((tmpDir / shardFile(shard.first)).parent_path());
+	}
+
+	parallelFor(work.size(), [&](size_t i) {
+		writeCompileCommands(tmpDir / shardFile(work[i]->first), entries, work[i]->second, indent);
+	});
+
+	// laid out like nlohmann's dump(4), but prefixes need not be valid UTF-8
+	JsonOutput manifest{tmpDir / shardManifestName};
+	manifest.put(shards.empty() ? "{\n    \"shards\": []," : "{\n    \"shards\": [");
+	bool first = true;
+	for (const auto &[prefix, selection] : shards) {
+		manifest.put(first ? "\n        {\n            \"directory\": " : ",\n        {\n            \"directory\": ");
+		first = false;
+		manifest.string(prefix);
+		manifest.put(",\n            \"entries\": ");
+		manifest.number(selection.size());
+		manifest.put(",\n            \"file\": ");
+		manifest.string(shardFile(prefix).string());
+		manifest.put("\n        }");
+	}
+	manifest.put(shards.empty() ? "\n    \"version\": 1\n}\n" : "\n    ],\n    \"version\": 1\n}\n");
+	manifest.finish();
+
+	if (renameat2(AT_FDCWD, tmpDir.c_str(), AT_FDCWD, dir.c_str(), RENAME_EXCHANGE) == 0) {
+		// tmpDir holds the old shards now
+		fs::remove_all(tmpDir);
+	} else if (rename(tmpDir.c_str(), dir.c_str()) < 0) {
+		std::cerr << "writing " << dir << " failed: " << strerror(errno) << std::endl;
+		exit(-1);
+	}
+}
@@ -0,0 +1,7 @@
+#include "capture.h"
+
+// ec-shim is what ec mounts over every compiler of the build. It only records
+// the invocation and execs the real compiler, see capture.h.
+int main(int argc, char **argv) {
+	return execCompiler(argc, argv);
+}
@@ -1,7 +1,16 @@
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <filesystem>
+#include <thread>
+#include <vector>
 
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #pragma once
 
@@ -43,3 +52,83 @@ private:
 	char *pathTemplateChar;
 };
 
+// Read-only mapping of a whole file; data() is nullptr for missing and empty
+// files.
+class MappedFile {
+public:
+	MappedFile(const fs::path &path) {
+		int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			return;
+		}
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size > 0) {
+			void *mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (mapping != MAP_FAILED) {
+				madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+				mappedData = static_cast<const char*>(mapping);
+				mappedSize = st.st_size;
+			}
+		}
+		close(fd);
+	}
+
+	~MappedFile() {
+		if (mappedData != nullptr) {
+			munmap(const_cast<char*>(mappedData), mappedSize);
+		}
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile &operator=(const MappedFile&) = delete;
+
+	const char *data() const {
+		return mappedData;
+	}
+
+	size_t size() const {
+		return mappedSize;
+	}
+
+	// Drops the pages that lie entirely within [begin, end) from memory, for
+	// ranges that have been consumed; reading them again faults them back in.
+	void release(const char *begin, const char *end) {
+		uintptr_t pageSize = sysconf(_SC_PAGESIZE);
+		uintptr_t first = (reinterpret_cast<uintptr_t>(begin) + pageSize - 1) & ~(pageSize - 1);
+		uintptr_t last = reinterpret_cast<uintptr_t>(end) & ~(pageSize - 1);
+		if (first < last) {
+			madvise(reinterpret_cast<void*>(first), last - first, MADV_DONTNEED);
+		}
+	}
+private:
+	const char *mappedData = nullptr;
+	size_t mappedSize = 0;
+};
+
+// Threads for count independent pieces of work: one per core, not more than
+// there are pieces.
+inline size_t parallelism(size_t count) {
+	return std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), count);
+}
+
+// Calls work(i) for every i < count on parallelism(count) threads, the calling
+// one included. Each thread picks the next i from a shared counter, so slow
+// pieces do not hold up the rest; returns once all are done.
+template<typename Work>
+void parallelFor(size_t count, Work work) {
+	std::atomic<size_t> next{0};
+	auto worker = [&]() {
+		for (size_t i = next++; i < count; i = next++) {
+			work(i);
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < parallelism(count); i++) {
+		threads.emplace_back(worker);
+	}
+	worker();
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+}